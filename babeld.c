@@ -70,6 +70,7 @@ const char *logfile = NULL,
     *pidfile = "/var/run/babeld.pid",
     *state_file = "/var/lib/babel-state";
 
+/* Room for BABEL_RECV_BATCH packets of receive_buffer_size bytes each. */
 unsigned char *receive_buffer = NULL;
 int receive_buffer_size = 0;
 
@@ -94,6 +95,8 @@ static volatile sig_atomic_t exiting = 0, dumping = 0, reopening = 0;
 
 static int accept_local_connections(fd_set *readfds);
 static int kernel_routes_callback(int changed, void *closure);
+static int kernel_route_callback(int add, struct kernel_route *route,
+                                 void *closure);
 static void init_signals(void);
 static void dump_tables(FILE *out);
 static int reopen_logfile(void);
@@ -101,7 +104,8 @@ static int reopen_logfile(void);
 int
 main(int argc, char **argv)
 {
-    struct sockaddr_in6 sin6;
+    struct sockaddr_in6 sin6[BABEL_RECV_BATCH];
+    int lens[BABEL_RECV_BATCH];
     int rc, fd, i, opt;
     time_t expiry_time, source_expiry_time, kernel_dump_time;
     const char **config_files = NULL;
@@ -533,9 +537,7 @@ main(int argc, char **argv)
 
     /* Make some noise so that others notice us, and send retractions in
        case we were restarted recently */
-    FOR_ALL_INTERFACES(ifp) {
-        if(!if_up(ifp))
-            continue;
+    FOR_ALL_UP_INTERFACES(ifp) {
         /* Apply jitter before we send the first message. */
         usleep(roughly(10000));
         gettime(&now);
@@ -543,9 +545,7 @@ main(int argc, char **argv)
         send_wildcard_retraction(ifp);
     }
 
-    FOR_ALL_INTERFACES(ifp) {
-        if(!if_up(ifp))
-            continue;
+    FOR_ALL_UP_INTERFACES(ifp) {
         usleep(roughly(10000));
         gettime(&now);
         send_hello(ifp);
@@ -567,12 +567,11 @@ main(int argc, char **argv)
         tv = check_neighbours_timeout;
         timeval_min(&tv, &check_interfaces_timeout);
         timeval_min_sec(&tv, expiry_time);
+        timeval_min_sec(&tv, route_expiry_time());
         timeval_min_sec(&tv, source_expiry_time);
         timeval_min_sec(&tv, kernel_dump_time);
         timeval_min(&tv, &resend_time);
-        FOR_ALL_INTERFACES(ifp) {
-            if(!if_up(ifp))
-                continue;
+        FOR_ALL_UP_INTERFACES(ifp) {
             timeval_min(&tv, &ifp->flush_timeout);
             timeval_min(&tv, &ifp->hello_timeout);
             timeval_min(&tv, &ifp->update_timeout);
@@ -618,28 +617,29 @@ main(int argc, char **argv)
             break;
 
         if(kernel_socket >= 0 && FD_ISSET(kernel_socket, &readfds))
-            kernel_callback(kernel_routes_callback, NULL);
+            kernel_callback(kernel_routes_callback, kernel_route_callback,
+                            NULL);
 
         if(FD_ISSET(protocol_socket, &readfds)) {
-            rc = babel_recv(protocol_socket,
-                            receive_buffer, receive_buffer_size,
-                            (struct sockaddr*)&sin6, sizeof(sin6));
+            rc = babel_recv_multi(protocol_socket,
+                                  receive_buffer, receive_buffer_size,
+                                  sin6, sizeof(struct sockaddr_in6),
+                                  lens, BABEL_RECV_BATCH);
             if(rc < 0) {
                 if(errno != EAGAIN && errno != EINTR) {
                     perror("recv");
                     sleep(1);
                 }
             } else {
-                FOR_ALL_INTERFACES(ifp) {
-                    if(!if_up(ifp))
+                for(i = 0; i < rc; i++) {
+                    unsigned char *packet =
+                        receive_buffer + i * receive_buffer_size;
+                    ifp = find_interface_ifindex(sin6[i].sin6_scope_id);
+                    if(ifp == NULL)
                         continue;
-                    if(ifp->ifindex == sin6.sin6_scope_id) {
-                        parse_packet((unsigned char*)&sin6.sin6_addr, ifp,
-                                     receive_buffer, rc);
-                        VALGRIND_MAKE_MEM_UNDEFINED(receive_buffer,
-                                                    receive_buffer_size);
-                        break;
-                    }
+                    parse_packet((unsigned char*)&sin6[i].sin6_addr, ifp,
+                                 packet, lens[i]);
+                    VALGRIND_MAKE_MEM_UNDEFINED(packet, receive_buffer_size);
                 }
             }
         }
@@ -680,16 +680,20 @@ main(int argc, char **argv)
 
         if(kernel_link_changed || kernel_addr_changed) {
             check_interfaces();
-            kernel_link_changed = 0;
+            kernel_addr_changed = 0;
         }
 
-        if(kernel_routes_changed || kernel_addr_changed ||
+        /* Individual routes and addresses have already been applied by
+           kernel_route_callback; a full check is only needed when the
+           kernel could not report them one by one.  A link change may
+           have renumbered the filters. */
+        if(kernel_routes_changed || kernel_link_changed ||
            kernel_rules_changed || now.tv_sec >= kernel_dump_time) {
             rc = check_xroutes(1);
             if(rc < 0)
                 fprintf(stderr, "Warning: couldn't check exported routes.\n");
             kernel_routes_changed = kernel_rules_changed =
-                kernel_addr_changed = 0;
+                kernel_link_changed = 0;
             if(kernel_socket >= 0)
                 kernel_dump_time = now.tv_sec + roughly(300);
             else
@@ -709,20 +713,20 @@ main(int argc, char **argv)
             schedule_interfaces_check(30000, 1);
         }
 
-        if(now.tv_sec >= expiry_time) {
+        if(now.tv_sec >= route_expiry_time())
             expire_routes();
+
+        if(now.tv_sec >= expiry_time) {
             expire_resend();
             expiry_time = now.tv_sec + roughly(30);
         }
 
         if(now.tv_sec >= source_expiry_time) {
-            expire_sources();
-            source_expiry_time = now.tv_sec + roughly(300);
+            rc = expire_sources();
+            source_expiry_time = now.tv_sec + (rc ? 1 : roughly(300));
         }
 
-        FOR_ALL_INTERFACES(ifp) {
-            if(!if_up(ifp))
-                continue;
+        FOR_ALL_UP_INTERFACES(ifp) {
             if(timeval_compare(&now, &ifp->hello_timeout) >= 0)
                 send_hello(ifp);
             if(timeval_compare(&now, &ifp->update_timeout) >= 0)
@@ -738,12 +742,10 @@ main(int argc, char **argv)
 
         if(unicast_flush_timeout.tv_sec != 0) {
             if(timeval_compare(&now, &unicast_flush_timeout) >= 0)
-                flush_unicast(1);
+                flush_unicasts();
         }
 
-        FOR_ALL_INTERFACES(ifp) {
-            if(!if_up(ifp))
-                continue;
+        FOR_ALL_UP_INTERFACES(ifp) {
             if(ifp->flush_timeout.tv_sec != 0) {
                 if(timeval_compare(&now, &ifp->flush_timeout) >= 0)
                     flushbuf(ifp);
@@ -763,9 +765,7 @@ main(int argc, char **argv)
     /* We need to flush so interface_up won't try to reinstall. */
     flush_all_routes();
 
-    FOR_ALL_INTERFACES(ifp) {
-        if(!if_up(ifp))
-            continue;
+    FOR_ALL_UP_INTERFACES(ifp) {
         send_wildcard_retraction(ifp);
         /* Make sure that we expire quickly from our neighbours'
            association caches. */
@@ -925,7 +925,7 @@ resize_receive_buffer(int size)
         return 0;
 
     if(receive_buffer == NULL) {
-        receive_buffer = malloc(size);
+        receive_buffer = malloc(size * BABEL_RECV_BATCH);
         if(receive_buffer == NULL) {
             perror("malloc(receive_buffer)");
             return -1;
@@ -933,7 +933,7 @@ resize_receive_buffer(int size)
         receive_buffer_size = size;
     } else {
         unsigned char *new;
-        new = realloc(receive_buffer, size);
+        new = realloc(receive_buffer, size * BABEL_RECV_BATCH);
         if(new == NULL) {
             perror("realloc(receive_buffer)");
             return -1;
@@ -1019,20 +1019,21 @@ dump_route(FILE *out, struct babel_route *route)
     const unsigned char *nexthop =
         memcmp(route->nexthop, route->neigh->address, 16) == 0 ?
         NULL : route->nexthop;
+    const unsigned char *route_chan = route_channels(route);
     char channels[100];
 
-    if(route->channels[0] == 0)
+    if(route_chan[0] == 0)
         channels[0] = '\0';
     else {
         int k, j = 0;
         snprintf(channels, 100, " chan (");
         j = strlen(channels);
         for(k = 0; k < DIVERSITY_HOPS; k++) {
-            if(route->channels[k] == 0)
+            if(route_chan[k] == 0)
                 break;
             if(k > 0)
                 channels[j++] = ',';
-            snprintf(channels + j, 100 - j, "%u", (unsigned)route->channels[k]);
+            snprintf(channels + j, 100 - j, "%u", (unsigned)route_chan[k]);
             j = strlen(channels);
         }
         snprintf(channels + j, 100 - j, ")");
@@ -1069,6 +1070,7 @@ dump_xroute(FILE *out, struct xroute *xroute)
 static void
 dump_tables(FILE *out)
 {
+    struct interface *ifp;
     struct neighbour *neigh;
     struct xroute_stream *xroutes;
     struct route_stream *routes;
@@ -1077,6 +1079,18 @@ dump_tables(FILE *out)
 
     fprintf(out, "My id %s seqno %d\n", format_eui64(myid), myseqno);
 
+    FOR_ALL_UP_INTERFACES(ifp) {
+        fprintf(out, "Interface %s queued %d (max %d) deferred %lu "
+                "(%lu ms avg, %u ms max) dropped %lu.\n",
+                ifp->name,
+                ifp->sendq.num + ifp->helloq.num + ifp->unicastq.num,
+                ifp->max_queued,
+                ifp->deferred_packets,
+                ifp->deferred_packets > 0 ?
+                ifp->deferral_msecs / ifp->deferred_packets : 0,
+                ifp->max_deferral_msecs, ifp->dropped_packets);
+    }
+
     FOR_ALL_NEIGHBOURS(neigh) {
         fprintf(out, "Neighbour %s dev %s reach %04x rxcost %d txcost %d "
                 "rtt %s rttcost %d chan %d%s.\n",
@@ -1156,3 +1170,9 @@ kernel_routes_callback(int changed, void *closure)
         kernel_rules_changed = 1;
     return 1;
 }
+
+static int
+kernel_route_callback(int add, struct kernel_route *route, void *closure)
+{
+    return update_xroute(add, route);
+}
@@ -543,6 +543,13 @@ parse_anonymous_ifconf(int c, gnc_t gnc, void *closure,
             if(c < -1 || cost <= 0 || cost > 0xFFFF)
                 goto error;
             if_conf->max_rtt_penalty = cost;
+        } else if(strcmp(token, "packet-rate") == 0) {
+            int rate;
+            c = getint(c, &rate, gnc, closure);
+            /* The bucket is refilled with microsecond accuracy. */
+            if(c < -1 || rate <= 0 || rate > 1000000)
+                goto error;
+            if_conf->packet_rate = rate;
         } else {
             goto error;
         }
@@ -629,6 +636,7 @@ merge_ifconf(struct interface_conf *dest,
     MERGE(rtt_min);
     MERGE(rtt_max);
     MERGE(max_rtt_penalty);
+    MERGE(packet_rate);
 
 #undef MERGE
 }
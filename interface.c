@@ -43,6 +43,82 @@ THE SOFTWARE.
 
 struct interface *interfaces = NULL;
 
+/* The interfaces that are up, in the same order as in interfaces, and a
+   hash table of the same interfaces keyed on ifindex.  Both are rebuilt
+   whenever an interface changes status, which is rare. */
+struct interface *up_interfaces = NULL;
+static struct interface **ifindex_table = NULL;
+static int ifindex_table_size = 0;
+
+static int
+ifindex_hash(unsigned int ifindex, int size)
+{
+    return ((ifindex * 0x9E3779B1U) >> 16) & (size - 1);
+}
+
+static void
+index_interfaces(void)
+{
+    struct interface *ifp, **last;
+    int n = 0, size, h;
+
+    last = &up_interfaces;
+    FOR_ALL_INTERFACES(ifp) {
+        if(!if_up(ifp))
+            continue;
+        *last = ifp;
+        last = &ifp->up_next;
+        n++;
+    }
+    *last = NULL;
+
+    size = 16;
+    while(size < n)
+        size *= 2;
+
+    if(size != ifindex_table_size) {
+        free(ifindex_table);
+        ifindex_table = malloc(size * sizeof(struct interface*));
+        if(ifindex_table == NULL) {
+            /* find_interface_ifindex will walk the list of interfaces. */
+            perror("malloc(ifindex_table)");
+            ifindex_table_size = 0;
+            return;
+        }
+        ifindex_table_size = size;
+    }
+    memset(ifindex_table, 0, size * sizeof(struct interface*));
+
+    FOR_ALL_UP_INTERFACES(ifp) {
+        h = ifindex_hash(ifp->ifindex, size);
+        ifp->ifindex_next = ifindex_table[h];
+        ifindex_table[h] = ifp;
+    }
+}
+
+/* Return the interface that is up and has a given ifindex, if any. */
+struct interface *
+find_interface_ifindex(unsigned int ifindex)
+{
+    struct interface *ifp;
+
+    if(ifindex_table_size == 0) {
+        FOR_ALL_UP_INTERFACES(ifp) {
+            if(ifp->ifindex == ifindex)
+                return ifp;
+        }
+        return NULL;
+    }
+
+    ifp = ifindex_table[ifindex_hash(ifindex, ifindex_table_size)];
+    while(ifp) {
+        if(ifp->ifindex == ifindex)
+            return ifp;
+        ifp = ifp->ifindex_next;
+    }
+    return NULL;
+}
+
 static struct interface *
 last_interface(void)
 {
@@ -76,8 +152,9 @@ add_interface(char *ifname, struct interface_conf *if_conf)
     memset(ifp, 0, sizeof(struct interface));
     strncpy(ifp->name, ifname, IF_NAMESIZE);
     ifp->conf = if_conf ? if_conf : default_interface_conf;
-    ifp->bucket_time = now.tv_sec;
+    ifp->bucket_time = now;
     ifp->bucket = BUCKET_TOKENS_MAX;
+    ifp->packet_rate = BUCKET_TOKENS_PER_SEC;
     ifp->hello_seqno = (random() & 0xFFFF);
 
     if(interfaces == NULL)
@@ -177,18 +254,38 @@ check_interface_channel(struct interface *ifp)
     return 0;
 }
 
+static int
+add_link_local_address(struct kernel_route *route, void *closure)
+{
+    struct interface *ifp = closure;
+    unsigned char (*ll)[16];
+
+    ll = realloc(ifp->ll, 16 * (ifp->numll + 1));
+    if(ll == NULL) {
+        perror("realloc(ll)");
+        return -1;
+    }
+    ifp->ll = ll;
+    memcpy(ifp->ll[ifp->numll], route->prefix, 16);
+    ifp->numll++;
+    return 1;
+}
+
 static int
 check_link_local_addresses(struct interface *ifp)
 {
-    struct kernel_route ll[32];
-    int rc, i;
+    int rc;
     if(ifp->ll)
         free(ifp->ll);
     ifp->numll = 0;
     ifp->ll = NULL;
-    rc = kernel_addresses(ifp->name, ifp->ifindex, 1, ll, 32);
+    rc = kernel_addresses(ifp->name, ifp->ifindex, 1,
+                          add_link_local_address, ifp);
     if(rc < 0) {
         perror("kernel_addresses(link local)");
+        free(ifp->ll);
+        ifp->numll = 0;
+        ifp->ll = NULL;
         return -1;
     } else if(rc == 0) {
         fprintf(stderr, "Interface %s has no link-local address.\n",
@@ -197,15 +294,6 @@ check_link_local_addresses(struct interface *ifp)
            real soon. */
         schedule_interfaces_check(2000, 0);
         return -1;
-    } else {
-        ifp->ll = malloc(16 * rc);
-        if(ifp->ll == NULL) {
-            perror("malloc(ll)");
-        } else {
-            for(i = 0; i < rc; i++)
-                memcpy(ifp->ll[i], ll[i].prefix, 16);
-            ifp->numll = rc;
-        }
     }
 
     return 0;
@@ -224,6 +312,7 @@ interface_up(struct interface *ifp, int up)
         ifp->flags |= IF_UP;
     else
         ifp->flags &= ~IF_UP;
+    index_interfaces();
 
     if(up) {
         if(ifp->ifindex <= 0) {
@@ -258,6 +347,7 @@ interface_up(struct interface *ifp, int up)
 
         if(ifp->sendbuf)
             free(ifp->sendbuf);
+        free_send_queues(ifp);
 
         /* 40 for IPv6 header, 8 for UDP header, 12 for good luck. */
         ifp->bufsize = mtu - sizeof(packet_header) - 60;
@@ -357,6 +447,10 @@ interface_up(struct interface *ifp, int up)
         }
         ifp->max_rtt_penalty = IF_CONF(ifp, max_rtt_penalty);
 
+        ifp->packet_rate =
+            IF_CONF(ifp, packet_rate) > 0 ?
+            IF_CONF(ifp, packet_rate) : BUCKET_TOKENS_PER_SEC;
+
         if(IF_CONF(ifp, enable_timestamps) == CONFIG_YES ||
            (IF_CONF(ifp, enable_timestamps) == CONFIG_DEFAULT &&
             ifp->max_rtt_penalty > 0))
@@ -395,6 +489,7 @@ interface_up(struct interface *ifp, int up)
         ifp->buffered = 0;
         ifp->bufsize = 0;
         free(ifp->sendbuf);
+        free_send_queues(ifp);
         ifp->num_buffered_updates = 0;
         ifp->update_bufsize = 0;
         if(ifp->buffered_updates)
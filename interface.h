@@ -21,7 +21,6 @@ THE SOFTWARE.
 */
 
 struct buffered_update {
-    unsigned char id[8];
     unsigned char prefix[16];
     unsigned char src_prefix[16];
     unsigned char plen;
@@ -29,6 +28,15 @@ struct buffered_update {
     unsigned char pad[2];
 };
 
+/* Finished packets, each preceded by a struct queued_packet, waiting to
+   be sent by flushqueue.  See queuebuf. */
+struct send_queue {
+    unsigned char *packets;
+    int size;
+    int first;
+    int num;
+};
+
 struct interface_conf {
     char *ifname;
     unsigned hello_interval;
@@ -44,6 +52,7 @@ struct interface_conf {
     unsigned int rtt_min;
     unsigned int rtt_max;
     unsigned int max_rtt_penalty;
+    unsigned int packet_rate;
     struct interface_conf *next;
 };
 
@@ -65,6 +74,8 @@ struct interface_conf {
 
 struct interface {
     struct interface *next;
+    struct interface *up_next;      /* see FOR_ALL_UP_INTERFACES */
+    struct interface *ifindex_next; /* see find_interface_ifindex */
     struct interface_conf *conf;
     unsigned int ifindex;
     unsigned short flags;
@@ -86,15 +97,29 @@ struct interface {
     char have_buffered_id;
     char have_buffered_nh;
     char have_buffered_prefix;
+    char have_buffered_ihu;
     unsigned char buffered_id[16];
     unsigned char buffered_nh[4];
     unsigned char buffered_prefix[16];
     unsigned char *sendbuf;
+    /* Multicast packets, multicast packets carrying a Hello or IHU, and
+       unicast packets to our neighbours.  The latter two are sent first,
+       so that they don't wait behind a backlog of updates. */
+    struct send_queue sendq;
+    struct send_queue helloq;
+    struct send_queue unicastq;
+    /* Send queue statistics, reported by dump_tables. */
+    int max_queued;
+    unsigned long deferred_packets;
+    unsigned long dropped_packets;
+    unsigned long deferral_msecs;
+    unsigned max_deferral_msecs;
     struct buffered_update *buffered_updates;
     int num_buffered_updates;
     int update_bufsize;
-    time_t bucket_time;
+    struct timeval bucket_time;
     unsigned int bucket;
+    unsigned int packet_rate;   /* tokens added to bucket per second */
     time_t last_update_time;
     unsigned short hello_seqno;
     unsigned hello_interval;
@@ -106,6 +131,8 @@ struct interface {
     unsigned int rtt_min;
     unsigned int rtt_max;
     unsigned int max_rtt_penalty;
+    /* Neighbours on this interface, linked through ifp_next. */
+    struct neighbour *neighbours;
 };
 
 #define IF_CONF(_ifp, _field) \
@@ -113,8 +140,14 @@ struct interface {
 
 extern struct interface *interfaces;
 
+extern struct interface *up_interfaces;
+
 #define FOR_ALL_INTERFACES(_ifp) for(_ifp = interfaces; _ifp; _ifp = _ifp->next)
 
+/* The body must not change the status of any interface. */
+#define FOR_ALL_UP_INTERFACES(_ifp) \
+    for(_ifp = up_interfaces; _ifp; _ifp = _ifp->up_next)
+
 static inline int
 if_up(struct interface *ifp)
 {
@@ -122,6 +155,7 @@ if_up(struct interface *ifp)
 }
 
 struct interface *add_interface(char *ifname, struct interface_conf *if_conf);
+struct interface *find_interface_ifindex(unsigned int ifindex);
 unsigned jitter(struct interface *ifp, int urgent);
 unsigned update_jitter(struct interface *ifp, int urgent);
 void set_timeout(struct timeval *timeout, int msecs);
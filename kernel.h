@@ -70,10 +70,18 @@ int kernel_route(int operation, const unsigned char *dest, unsigned short plen,
                  const unsigned char *gate, int ifindex, unsigned int metric,
                  const unsigned char *newgate, int newifindex,
                  unsigned int newmetric);
-int kernel_routes(struct kernel_route *routes, int maxroutes);
-int kernel_callback(int (*fn)(int, void*), void *closure);
+/* The dump functions pass every route to fn, which may return -1 to
+   interrupt the dump.  They return the number of routes found. */
+int kernel_routes(int (*fn)(struct kernel_route*, void*), void *closure);
+/* Routes and addresses that are added or removed are passed one at a time
+   to route_fn when the kernel interface knows about them.  CHANGE_ROUTE in
+   the mask passed to fn means that the routing table must be dumped
+   again. */
+int kernel_callback(int (*fn)(int, void*),
+                    int (*route_fn)(int, struct kernel_route*, void*),
+                    void *closure);
 int kernel_addresses(char *ifname, int ifindex, int ll,
-                     struct kernel_route *routes, int maxroutes);
+                     int (*fn)(struct kernel_route*, void*), void *closure);
 int if_eui64(char *ifname, int ifindex, unsigned char *eui);
 int gettime(struct timeval *tv);
 int read_random_bytes(void *buf, size_t len);
@@ -306,7 +306,9 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
         }
 
         if(len < 0) {
+            int saved_errno = errno;
             perror("netlink_read: recvmsg()");
+            errno = saved_errno;
             return 2;
         } else if(len == 0) {
             fprintf(stderr, "netlink_read: EOF\n");
@@ -1185,37 +1187,14 @@ print_kernel_route(int add, int protocol, int type,
            protocol, type);
 }
 
+/* Parses a route message, returns 1 if the route is of interest to us. */
 static int
-filter_kernel_routes(struct nlmsghdr *nh, void *data)
+parse_route_message(struct nlmsghdr *nh, struct kernel_route *route)
 {
     int rc;
-
-    struct kernel_route *current_route;
-    struct kernel_route route;
-
-    int maxroutes = 0;
-    struct kernel_route *routes = NULL;
-    int *found = NULL;
-    int len;
-
+    int len = nh->nlmsg_len;
     struct rtmsg *rtm;
 
-    if(data) {
-        void **args = (void**)data;
-        maxroutes = *(int*)args[0];
-        routes = (struct kernel_route *)args[1];
-        found = (int*)args[2];
-    }
-
-    len = nh->nlmsg_len;
-
-    if(data && *found >= maxroutes)
-        return 0;
-
-    if(nh->nlmsg_type != RTM_NEWROUTE &&
-       (data || nh->nlmsg_type != RTM_DELROUTE))
-        return 0;
-
     rtm = (struct rtmsg*)NLMSG_DATA(nh);
     len -= NLMSG_LENGTH(0);
 
@@ -1226,44 +1205,59 @@ filter_kernel_routes(struct nlmsghdr *nh, void *data)
     if(rtm->rtm_flags & RTM_F_CLONED)
         return 0;
 
-    if(data)
-        current_route = &routes[*found];
-    else
-        current_route = &route;
-
-    rc = parse_kernel_route_rta(rtm, len, current_route);
+    rc = parse_kernel_route_rta(rtm, len, route);
     if(rc < 0)
         return 0;
 
-    if(martian_prefix(current_route->prefix, current_route->plen) ||
-       martian_prefix(current_route->src_prefix, current_route->src_plen))
+    if(martian_prefix(route->prefix, route->plen) ||
+       martian_prefix(route->src_prefix, route->src_plen))
         return 0;
 
     /* Ignore default unreachable routes; no idea where they come from. */
-    if(current_route->plen == 0 && current_route->metric >= KERNEL_INFINITY)
+    if(route->plen == 0 && route->metric >= KERNEL_INFINITY)
         return 0;
 
-    if(debug >= 2) {
-        if(rc >= 0) {
-            print_kernel_route(nh->nlmsg_type, rtm->rtm_protocol,
-                               rtm->rtm_type, current_route);
-        }
-    }
-
-    if(data) *found = (*found)+1;
+    if(debug >= 2)
+        print_kernel_route(nh->nlmsg_type, rtm->rtm_protocol,
+                           rtm->rtm_type, route);
 
     return 1;
+}
 
+/* The state of a dump: the function the routes are passed to, and the
+   number of routes found so far. */
+struct kernel_dump {
+    int (*fn)(struct kernel_route*, void*);
+    void *closure;
+    int found;
+    int ifindex;
+    int ll;
+};
+
+static int
+filter_kernel_routes(struct nlmsghdr *nh, void *data)
+{
+    struct kernel_dump *dump = data;
+    struct kernel_route route;
+    int rc;
+
+    if(nh->nlmsg_type != RTM_NEWROUTE)
+        return 0;
+
+    rc = parse_route_message(nh, &route);
+    if(rc <= 0)
+        return rc;
+
+    dump->found++;
+    return dump->fn(&route, dump->closure) < 0 ? -1 : 1;
 }
 
 /* This function should not return routes installed by us. */
 int
-kernel_routes(struct kernel_route *routes, int maxroutes)
+kernel_routes(int (*fn)(struct kernel_route*, void*), void *closure)
 {
     int i, rc;
-    int maxr = maxroutes;
-    int found = 0;
-    void *data[3] = { &maxr, routes, &found };
+    struct kernel_dump dump = { fn, closure, 0, 0, 0 };
     int families[2] = { AF_INET6, AF_INET };
     char rule_exists[SRC_TABLE_NUM] = {0};
     struct rtgenmsg g;
@@ -1290,7 +1284,7 @@ kernel_routes(struct kernel_route *routes, int maxroutes)
             return -1;
 
         rc = netlink_read(&nl_command, NULL, 1,
-                          filter_kernel_routes, (void *)data);
+                          filter_kernel_routes, &dump);
         if(rc < 0)
             return -1;
 
@@ -1306,7 +1300,7 @@ kernel_routes(struct kernel_route *routes, int maxroutes)
         install_missing_rules(rule_exists, families[i] == AF_INET);
     }
 
-    return found;
+    return dump.found;
 }
 
 static char *
@@ -1398,37 +1392,16 @@ filter_link(struct nlmsghdr *nh, void *data)
     return 0;
 }
 
+/* Parses an address message into a host route, as exported by
+   kernel_addresses. */
 static int
-filter_addresses(struct nlmsghdr *nh, void *data)
+parse_addr_message(struct nlmsghdr *nh, struct kernel_route *route)
 {
     int rc;
-    int maxroutes = 0;
-    struct kernel_route *routes = NULL;
+    int len = nh->nlmsg_len;
     struct in6_addr addr;
-    int *found = NULL;
-    int len;
     struct ifaddrmsg *ifa;
     char ifname[IFNAMSIZ];
-    int ifindex = 0;
-    int ll = 0;
-
-    if(data) {
-        void **args = (void **)data;
-        maxroutes = *(int *)args[0];
-        routes = (struct kernel_route*)args[1];
-        found = (int *)args[2];
-        ifindex = args[3] ? *(int*)args[3] : 0;
-        ll = args[4] ? !!*(int*)args[4] : 0;
-    }
-
-    len = nh->nlmsg_len;
-
-    if(data && *found >= maxroutes)
-        return 0;
-
-    if(nh->nlmsg_type != RTM_NEWADDR &&
-       (data || nh->nlmsg_type != RTM_DELADDR))
-        return 0;
 
     ifa = (struct ifaddrmsg *)NLMSG_DATA(nh);
     len -= NLMSG_LENGTH(0);
@@ -1437,60 +1410,97 @@ filter_addresses(struct nlmsghdr *nh, void *data)
     if(rc < 0)
         return 0;
 
-    if(data && ll == !IN6_IS_ADDR_LINKLOCAL(&addr))
+    kdebugf("found address on interface %s(%d): %s\n",
+            if_indextoname(ifa->ifa_index, ifname), ifa->ifa_index,
+            format_address(addr.s6_addr));
+
+    memset(route, 0, sizeof(struct kernel_route));
+    memcpy(route->prefix, addr.s6_addr, 16);
+    route->plen = 128;
+    route->metric = 0;
+    route->ifindex = ifa->ifa_index;
+    route->proto = RTPROT_BABEL_LOCAL;
+    return 1;
+}
+
+static int
+filter_addresses(struct nlmsghdr *nh, void *data)
+{
+    struct kernel_dump *dump = data;
+    struct kernel_route route;
+    int rc;
+
+    if(nh->nlmsg_type != RTM_NEWADDR)
         return 0;
 
-    if(ifindex && ifa->ifa_index != ifindex)
+    rc = parse_addr_message(nh, &route);
+    if(rc <= 0)
         return 0;
 
-    kdebugf("found address on interface %s(%d): %s\n",
-            if_indextoname(ifa->ifa_index, ifname), ifa->ifa_index,
-            format_address(addr.s6_addr));
+    if(dump->ll == !IN6_IS_ADDR_LINKLOCAL((struct in6_addr*)route.prefix))
+        return 0;
 
-    if(data) {
-        struct kernel_route *route = &routes[*found];
-        memcpy(route->prefix, addr.s6_addr, 16);
-        route->plen = 128;
-        route->metric = 0;
-        route->ifindex = ifa->ifa_index;
-        route->proto = RTPROT_BABEL_LOCAL;
-        memset(route->gw, 0, 16);
-        *found = (*found)+1;
-    }
+    if(dump->ifindex && route.ifindex != dump->ifindex)
+        return 0;
 
-    return 1;
+    dump->found++;
+    return dump->fn(&route, dump->closure) < 0 ? -1 : 1;
 }
 
+/* The state of kernel_callback: the changes that must be reported in
+   bulk, and the function that is notified of individual routes. */
+struct netlink_changes {
+    int changed;
+    int (*route_fn)(int, struct kernel_route*, void*);
+    void *closure;
+};
+
 static int
 filter_netlink(struct nlmsghdr *nh, void *data)
 {
     int rc;
-    int *changed = data;
+    struct netlink_changes *changes = data;
+    struct kernel_route route;
+    int add;
 
     switch(nh->nlmsg_type) {
     case RTM_NEWROUTE:
     case RTM_DELROUTE:
-        rc = filter_kernel_routes(nh, NULL);
-        if(changed && rc > 0)
-            *changed |= CHANGE_ROUTE;
+        rc = parse_route_message(nh, &route);
+        if(rc <= 0)
+            return rc;
+        add = nh->nlmsg_type == RTM_NEWROUTE;
+        if(changes->route_fn)
+            changes->route_fn(add, &route, changes->closure);
+        else
+            changes->changed |= CHANGE_ROUTE;
         return rc;
     case RTM_NEWLINK:
     case RTM_DELLINK:
         rc = filter_link(nh, NULL);
-        if(changed && rc > 0)
-            *changed |= CHANGE_LINK;
+        if(rc > 0)
+            changes->changed |= CHANGE_LINK;
         return rc;
     case RTM_NEWADDR:
     case RTM_DELADDR:
-        rc = filter_addresses(nh, NULL);
-        if(changed && rc > 0)
-            *changed |= CHANGE_ADDR;
+        rc = parse_addr_message(nh, &route);
+        if(rc <= 0)
+            return rc;
+        changes->changed |= CHANGE_ADDR;
+        /* Link-local addresses are not exported. */
+        if(IN6_IS_ADDR_LINKLOCAL((struct in6_addr*)route.prefix))
+            return rc;
+        add = nh->nlmsg_type == RTM_NEWADDR;
+        if(changes->route_fn)
+            changes->route_fn(add, &route, changes->closure);
+        else
+            changes->changed |= CHANGE_ROUTE;
         return rc;
     case RTM_NEWRULE:
     case RTM_DELRULE:
         rc = filter_kernel_rules(nh, NULL);
-        if(changed && rc > 0)
-            *changed |= CHANGE_RULE;
+        if(rc > 0)
+            changes->changed |= CHANGE_RULE;
         return rc;
     default:
         kdebugf("filter_netlink: unexpected message type %d\n",
@@ -1502,11 +1512,9 @@ filter_netlink(struct nlmsghdr *nh, void *data)
 
 int
 kernel_addresses(char *ifname, int ifindex, int ll,
-                 struct kernel_route *routes, int maxroutes)
+                 int (*fn)(struct kernel_route*, void*), void *closure)
 {
-    int maxr = maxroutes;
-    int found = 0;
-    void *data[] = { &maxr, routes, &found, &ifindex, &ll, NULL };
+    struct kernel_dump dump = { fn, closure, 0, ifindex, !!ll };
     struct rtgenmsg g;
     int rc;
 
@@ -1532,19 +1540,35 @@ kernel_addresses(char *ifname, int ifindex, int ll,
     if(rc < 0)
         return -1;
 
-    rc = netlink_read(&nl_command, NULL, 1, filter_addresses, (void*)data);
+    rc = netlink_read(&nl_command, NULL, 1, filter_addresses, &dump);
 
     if(rc < 0)
         return -1;
 
-    return found;
+    return dump.found;
+}
+
+/* Discard whatever is queued on a socket that overran.  The kernel drops
+   all notifications, without telling us again, until the queue has been
+   emptied. */
+static void
+netlink_drain(struct netlink *nl)
+{
+    char buf[8192];
+    int rc;
+
+    do {
+        rc = recv(nl->sock, buf, sizeof(buf), MSG_DONTWAIT);
+    } while(rc > 0 || (rc < 0 && (errno == EINTR || errno == ENOBUFS)));
 }
 
 int
-kernel_callback(int (*fn)(int, void*), void *closure)
+kernel_callback(int (*fn)(int, void*),
+                int (*route_fn)(int, struct kernel_route*, void*),
+                void *closure)
 {
     int rc;
-    int changed = 0;
+    struct netlink_changes changes = { 0, route_fn, closure };
 
     kdebugf("\nReceived changes in kernel tables.\n");
 
@@ -1555,15 +1579,25 @@ kernel_callback(int (*fn)(int, void*), void *closure)
             return -1;
         }
     }
-    rc = netlink_read(&nl_listen, &nl_command, 0, filter_netlink, &changed);
+    rc = netlink_read(&nl_listen, &nl_command, 0, filter_netlink, &changes);
 
-    if(rc < 0 && nl_listen.sock < 0)
+    if(rc < 0 && nl_listen.sock < 0) {
         kernel_setup_socket(1);
+        /* Whatever was pending on the old socket is lost. */
+        changes.changed |= CHANGE_ROUTE | CHANGE_RULE;
+    } else if(rc == 2 && errno == ENOBUFS) {
+        /* The socket overran, and the kernel dropped some messages.  The
+           tables will be dumped again after the socket has been drained,
+           which is when we start receiving notifications again. */
+        fprintf(stderr, "kernel_callback: lost netlink messages.\n");
+        netlink_drain(&nl_listen);
+        changes.changed |= CHANGE_ROUTE | CHANGE_RULE;
+    }
 
     /* if netlink return 0 (found something interesting) */
     /* or -1 (i.e. IO error), we call... back ! */
     if(rc)
-        return fn(changed, closure);
+        return fn(changes.changed, closure);
 
     return 0;
 }
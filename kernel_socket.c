@@ -667,12 +667,13 @@ parse_kernel_route(const struct rt_msghdr *rtm, struct kernel_route *route)
 }
 
 int
-kernel_routes(struct kernel_route *routes, int maxroutes)
+kernel_routes(int (*fn)(struct kernel_route*, void*), void *closure)
 {
     int mib[6];
     char *buf, *p;
     size_t len;
     struct rt_msghdr *rtm;
+    struct kernel_route route;
     int rc, i;
 
     mib[0] = CTL_NET;
@@ -702,16 +703,19 @@ kernel_routes(struct kernel_route *routes, int maxroutes)
 
     i = 0;
     p = buf;
-    while(p < buf + len && i < maxroutes) {
+    while(p < buf + len) {
         rtm = (struct rt_msghdr*)p;
-        rc = parse_kernel_route(rtm, &routes[i]);
+        rc = parse_kernel_route(rtm, &route);
         if(rc)
             goto cont;
 
         if(debug > 2)
-            print_kernel_route(1,&routes[i]);
+            print_kernel_route(1, &route);
 
         i++;
+        rc = fn(&route, closure);
+        if(rc < 0)
+            goto fail;
 
     cont:
         p += rtm->rtm_msglen;
@@ -769,9 +773,10 @@ socket_read(int sock)
 
 int
 kernel_addresses(char *ifname, int ifindex, int ll,
-                 struct kernel_route *routes, int maxroutes)
+                 int (*fn)(struct kernel_route*, void*), void *closure)
 {
     struct ifaddrs *ifa, *ifap;
+    struct kernel_route route;
     int rc, i;
 
     rc = getifaddrs(&ifa);
@@ -781,25 +786,20 @@ kernel_addresses(char *ifname, int ifindex, int ll,
     ifap = ifa;
     i = 0;
 
-    while(ifap && i < maxroutes) {
+    while(ifap) {
         if((ifname != NULL && strcmp(ifap->ifa_name, ifname) != 0))
             goto next;
+        memset(&route, 0, sizeof(route));
         if(ifap->ifa_addr->sa_family == AF_INET6) {
             struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)ifap->ifa_addr;
             if(!!ll != !!IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr))
                 goto next;
-            memcpy(routes[i].prefix, &sin6->sin6_addr, 16);
+            memcpy(route.prefix, &sin6->sin6_addr, 16);
             if(ll)
                 /* This a perfect example of counter-productive optimisation :
                    KAME encodes interface index onto bytes 2 and 3, so we have
                    to reset those bytes to 0 before passing them to babeld. */
-                memset(routes[i].prefix + 2, 0, 2);
-            routes[i].plen = 128;
-            routes[i].metric = 0;
-            routes[i].ifindex = ifindex;
-            routes[i].proto = RTPROT_BABEL_LOCAL;
-            memset(routes[i].gw, 0, 16);
-            i++;
+                memset(route.prefix + 2, 0, 2);
         } else if(ifap->ifa_addr->sa_family == AF_INET) {
             struct sockaddr_in *sin = (struct sockaddr_in*)ifap->ifa_addr;
             if(ll)
@@ -808,25 +808,31 @@ kernel_addresses(char *ifname, int ifindex, int ll,
             if(IN_LINKLOCAL(htonl(sin->sin_addr.s_addr)))
                 goto next;
 #endif
-            memcpy(routes[i].prefix, v4prefix, 12);
-            memcpy(routes[i].prefix + 12, &sin->sin_addr, 4);
-            routes[i].plen = 128;
-            routes[i].metric = 0;
-            routes[i].ifindex = ifindex;
-            routes[i].proto = RTPROT_BABEL_LOCAL;
-            memset(routes[i].gw, 0, 16);
-            i++;
+            memcpy(route.prefix, v4prefix, 12);
+            memcpy(route.prefix + 12, &sin->sin_addr, 4);
+        } else {
+            goto next;
         }
+        route.plen = 128;
+        route.metric = 0;
+        route.ifindex = ifindex;
+        route.proto = RTPROT_BABEL_LOCAL;
+        i++;
+        rc = fn(&route, closure);
+        if(rc < 0)
+            break;
  next:
         ifap = ifap->ifa_next;
     }
 
     freeifaddrs(ifa);
-    return i;
+    return rc < 0 ? -1 : i;
 }
 
 int
-kernel_callback(int (*fn)(int, void*), void *closure)
+kernel_callback(int (*fn)(int, void*),
+                int (*route_fn)(int, struct kernel_route*, void*),
+                void *closure)
 {
     int rc;
 
@@ -49,9 +49,10 @@ unsigned short myseqno = 0;
 struct timeval seqno_time = {0, 0};
 
 #define UNICAST_BUFSIZE 1024
-int unicast_buffered = 0;
-unsigned char *unicast_buffer = NULL;
-struct neighbour *unicast_neighbour = NULL;
+/* Neighbours with a non-empty unicast buffer, doubly linked through
+   unicast_next and unicast_pprev, and the earliest of their flush
+   timeouts. */
+static struct neighbour *unicast_neighbours = NULL;
 struct timeval unicast_flush_timeout = {0, 0};
 
 static const unsigned char v4prefix[16] =
@@ -797,27 +798,50 @@ parse_packet(const unsigned char *from, struct interface *ifp,
 
 /* Under normal circumstances, there are enough moderation mechanisms
    elsewhere in the protocol to make sure that this last-ditch check
-   should never trigger.  But I'm superstitious. */
+   should never trigger.  But I'm superstitious.  The bucket is refilled
+   at ifp->packet_rate tokens per second; bucket_time is the time at
+   which the last token was added, so that the unused part of a token
+   interval is not lost.  Returns the number of tokens taken, at most n. */
 
 static int
-check_bucket(struct interface *ifp)
+take_tokens(struct interface *ifp, int n)
 {
-    if(ifp->bucket <= 0) {
-        int seconds = now.tv_sec - ifp->bucket_time;
-        if(seconds > 0) {
-            ifp->bucket = MIN(BUCKET_TOKENS_MAX,
-                              seconds * BUCKET_TOKENS_PER_SEC);
+    struct timeval elapsed;
+    long long usecs;
+    int tokens;
+
+    timeval_minus(&elapsed, &now, &ifp->bucket_time);
+    if(timeval_compare(&now, &ifp->bucket_time) < 0) {
+        /* Clock stepped. */
+        ifp->bucket_time = now;
+    } else if(ifp->bucket >= BUCKET_TOKENS_MAX ||
+              elapsed.tv_sec >= BUCKET_TOKENS_MAX) {
+        /* Full, or will be: packet_rate is at least one. */
+        ifp->bucket = BUCKET_TOKENS_MAX;
+        ifp->bucket_time = now;
+    } else {
+        usecs = elapsed.tv_sec * 1000000LL + elapsed.tv_usec;
+        tokens = usecs * ifp->packet_rate / 1000000;
+        if(tokens >= BUCKET_TOKENS_MAX - ifp->bucket) {
+            ifp->bucket = BUCKET_TOKENS_MAX;
+            ifp->bucket_time = now;
+        } else if(tokens > 0) {
+            ifp->bucket += tokens;
+            /* Round up, so that we never get ahead of the rate. */
+            usecs = (tokens * 1000000LL + ifp->packet_rate - 1) /
+                ifp->packet_rate;
+            ifp->bucket_time.tv_sec += usecs / 1000000;
+            ifp->bucket_time.tv_usec += usecs % 1000000;
+            if(ifp->bucket_time.tv_usec >= 1000000) {
+                ifp->bucket_time.tv_sec++;
+                ifp->bucket_time.tv_usec -= 1000000;
+            }
         }
-        /* Reset bucket time unconditionally, in case clock is stepped. */
-        ifp->bucket_time = now.tv_sec;
     }
 
-    if(ifp->bucket > 0) {
-        ifp->bucket--;
-        return 1;
-    } else {
-        return 0;
-    }
+    n = MIN(n, ifp->bucket);
+    ifp->bucket -= n;
+    return n;
 }
 
 static int
@@ -843,94 +867,359 @@ fill_rtt_message(struct interface *ifp)
     return 0;
 }
 
-void
-flushbuf(struct interface *ifp)
+static void
+schedule_flush(struct interface *ifp)
 {
-    int rc;
+    unsigned msecs = jitter(ifp, 0);
+    if(ifp->flush_timeout.tv_sec != 0 &&
+       timeval_minus_msec(&ifp->flush_timeout, &now) < msecs)
+        return;
+    set_timeout(&ifp->flush_timeout, msecs);
+}
+
+static void
+schedule_flush_msecs(struct interface *ifp, unsigned msecs)
+{
+    if(ifp->flush_timeout.tv_sec != 0 &&
+       timeval_minus_msec(&ifp->flush_timeout, &now) < msecs)
+        return;
+    set_timeout(&ifp->flush_timeout, msecs);
+}
+
+static void
+schedule_flush_now(struct interface *ifp)
+{
+    /* Almost now */
+    schedule_flush_msecs(ifp, roughly(10));
+}
+
+static void
+multicast_address(struct interface *ifp, struct sockaddr_in6 *sin6)
+{
+    memset(sin6, 0, sizeof(*sin6));
+    sin6->sin6_family = AF_INET6;
+    memcpy(&sin6->sin6_addr, protocol_group, 16);
+    sin6->sin6_port = htons(protocol_port);
+    sin6->sin6_scope_id = ifp->ifindex;
+}
+
+/* Arrange for flushqueue to be called almost now if the bucket has a
+   token, and when it gets one otherwise. */
+static void
+schedule_flushqueue(struct interface *ifp)
+{
+    int msecs;
+
+    take_tokens(ifp, 0);
+    if(ifp->bucket > 0) {
+        schedule_flush_now(ifp);
+    } else {
+        struct timeval elapsed;
+        long long usecs;
+        timeval_minus(&elapsed, &now, &ifp->bucket_time);
+        usecs = (1000000 + ifp->packet_rate - 1) / ifp->packet_rate -
+            (elapsed.tv_sec * 1000000LL + elapsed.tv_usec);
+        msecs = (usecs + 999) / 1000;
+        schedule_flush_msecs(ifp, MAX(msecs, 1));
+    }
+}
+
+/* Each packet in a send queue is preceded by this header.  The stride
+   is a multiple of the alignment of the header. */
+struct queued_packet {
+    struct timeval time;        /* when it was queued */
+    unsigned char address[16];  /* destination of a unicast packet */
+    int timestamp;              /* offset of the hello timestamp, or -1 */
+    int deferred;               /* had to wait for the bucket */
+};
+
+#define SENDQ_STRIDE(ifp) \
+    ((sizeof(struct queued_packet) + sizeof(packet_header) + \
+      (ifp)->bufsize + 7) & ~7)
+
+/* Account for a packet that is about to leave the queue, and refresh its
+   timestamp if it had to wait. */
+static int
+dequeue_packet(struct interface *ifp, struct queued_packet *q)
+{
+    unsigned char *packet = (unsigned char*)(q + 1);
+    unsigned msecs;
+
+    if(q->deferred) {
+        msecs = timeval_minus_msec(&now, &q->time);
+        ifp->deferred_packets++;
+        ifp->deferral_msecs += msecs;
+        ifp->max_deferral_msecs = MAX(ifp->max_deferral_msecs, msecs);
+        if(q->timestamp >= 0)
+            DO_HTONL(packet + q->timestamp, time_us(now));
+    }
+    return sizeof(packet_header) + ((packet[2] << 8) | packet[3]);
+}
+
+static int
+queued_packets(struct interface *ifp)
+{
+    return ifp->sendq.num + ifp->helloq.num + ifp->unicastq.num;
+}
+
+static void
+defer_packets(struct interface *ifp, struct send_queue *sendq)
+{
+    int stride = SENDQ_STRIDE(ifp);
+    struct queued_packet *q;
+    int i;
+
+    for(i = 0; i < sendq->num; i++) {
+        q = (struct queued_packet*)
+            (sendq->packets + (sendq->first + i) * stride);
+        q->deferred = 1;
+    }
+}
+
+/* Send the multicast packets in sendq, in batches, as many as the bucket
+   allows. */
+static void
+send_multicast_queue(struct interface *ifp, struct send_queue *sendq)
+{
+    int lens[BABEL_SEND_BATCH];
+    int stride = SENDQ_STRIDE(ifp);
     struct sockaddr_in6 sin6;
+    unsigned char *start;
+    int i, n, rc;
 
-    assert(ifp->buffered <= ifp->bufsize);
+    while(sendq->num > 0) {
+        n = take_tokens(ifp, MIN(sendq->num, BABEL_SEND_BATCH));
+        if(n == 0)
+            break;
 
-    flushupdates(ifp);
+        start = sendq->packets + sendq->first * stride;
+        for(i = 0; i < n; i++)
+            lens[i] = dequeue_packet(ifp,
+                                     (struct queued_packet*)
+                                     (start + i * stride));
+
+        multicast_address(ifp, &sin6);
+        rc = babel_send_multi(protocol_socket,
+                              start + sizeof(struct queued_packet), stride,
+                              lens, n,
+                              (struct sockaddr*)&sin6, sizeof(sin6));
+        if(rc < 0)
+            perror("send");
+        VALGRIND_MAKE_MEM_UNDEFINED(start, n * stride);
+        sendq->first += n;
+        sendq->num -= n;
+    }
 
-    if(ifp->buffered > 0) {
-        debugf("  (flushing %d buffered bytes on %s)\n",
-               ifp->buffered, ifp->name);
-        if(check_bucket(ifp)) {
+    if(sendq->num == 0)
+        sendq->first = 0;
+}
+
+/* Send the packets queued by queuebuf, as many as the bucket allows:
+   hellos first, then unicast, then the rest.  The rest are left in the
+   queues, and the flush timeout is set to the time at which the bucket
+   will have a token again. */
+static void
+flushqueue(struct interface *ifp)
+{
+    int stride = SENDQ_STRIDE(ifp);
+    struct sockaddr_in6 sin6;
+    struct queued_packet *q;
+    int i, n, len, rc;
+
+    gettime(&now);
+
+    send_multicast_queue(ifp, &ifp->helloq);
+
+    while(ifp->helloq.num == 0 && ifp->unicastq.num > 0) {
+        n = take_tokens(ifp, MIN(ifp->unicastq.num, BABEL_SEND_BATCH));
+        if(n == 0)
+            break;
+
+        /* Each has its own destination, so there's no point in batching. */
+        for(i = 0; i < n; i++) {
+            q = (struct queued_packet*)
+                (ifp->unicastq.packets + ifp->unicastq.first * stride);
+            len = dequeue_packet(ifp, q);
             memset(&sin6, 0, sizeof(sin6));
             sin6.sin6_family = AF_INET6;
-            memcpy(&sin6.sin6_addr, protocol_group, 16);
+            memcpy(&sin6.sin6_addr, q->address, 16);
             sin6.sin6_port = htons(protocol_port);
             sin6.sin6_scope_id = ifp->ifindex;
-            DO_HTONS(packet_header + 2, ifp->buffered);
-            fill_rtt_message(ifp);
-            rc = babel_send(protocol_socket,
-                            packet_header, sizeof(packet_header),
-                            ifp->sendbuf, ifp->buffered,
+            rc = babel_send(protocol_socket, q + 1, len, NULL, 0,
                             (struct sockaddr*)&sin6, sizeof(sin6));
             if(rc < 0)
-                perror("send");
+                perror("send(unicast)");
+            VALGRIND_MAKE_MEM_UNDEFINED(q, stride);
+            ifp->unicastq.first++;
+            ifp->unicastq.num--;
+        }
+    }
+
+    if(ifp->unicastq.num == 0)
+        ifp->unicastq.first = 0;
+
+    if(ifp->helloq.num == 0 && ifp->unicastq.num == 0)
+        send_multicast_queue(ifp, &ifp->sendq);
+
+    /* Unless there's a packet being buffered, the flush timeout is ours. */
+    if(ifp->buffered == 0) {
+        ifp->flush_timeout.tv_sec = 0;
+        ifp->flush_timeout.tv_usec = 0;
+    }
+
+    if(queued_packets(ifp) == 0)
+        return;
+
+    defer_packets(ifp, &ifp->helloq);
+    defer_packets(ifp, &ifp->unicastq);
+    defer_packets(ifp, &ifp->sendq);
+    schedule_flushqueue(ifp);
+}
+
+/* Make room for one more packet at the end of a send queue.  Returns
+   the slot, or NULL if the queue is full. */
+static struct queued_packet *
+sendq_slot(struct interface *ifp, struct send_queue *sendq)
+{
+    int stride = SENDQ_STRIDE(ifp);
+    unsigned char *new;
+    int size;
+
+    if(sendq->first + sendq->num >= sendq->size) {
+        if(sendq->first > 0) {
+            memmove(sendq->packets, sendq->packets + sendq->first * stride,
+                    sendq->num * stride);
+            sendq->first = 0;
+        } else if(sendq->size < MAX_SENDQ) {
+            size = sendq->size == 0 ?
+                BABEL_SEND_BATCH : MIN(2 * sendq->size, MAX_SENDQ);
+            new = realloc(sendq->packets, size * stride);
+            if(new == NULL) {
+                perror("realloc(sendq)");
+                return NULL;
+            }
+            sendq->packets = new;
+            sendq->size = size;
         } else {
-            fprintf(stderr, "Warning: bucket full, dropping packet to %s.\n",
-                    ifp->name);
+            return NULL;
+        }
+    }
+
+    return (struct queued_packet*)
+        (sendq->packets + (sendq->first + sendq->num) * stride);
+}
+
+static void
+free_send_queue(struct send_queue *sendq)
+{
+    free(sendq->packets);
+    sendq->packets = NULL;
+    sendq->size = sendq->first = sendq->num = 0;
+}
+
+/* Discard the packets queued on ifp; they count as dropped. */
+void
+free_send_queues(struct interface *ifp)
+{
+    ifp->dropped_packets += queued_packets(ifp);
+    free_send_queue(&ifp->sendq);
+    free_send_queue(&ifp->helloq);
+    free_send_queue(&ifp->unicastq);
+}
+
+/* Finish the packet in sendbuf, and queue it to be sent by flushqueue.
+   A packet carrying a Hello or IHU goes to helloq and is sent at once.
+   The others are drained when they make a batch, by flushbuf, and at the
+   end of flushupdates; in the meantime, the flush timeout is kept short
+   if the bucket has a token.  Packets that the bucket doesn't let through
+   stay queued. */
+static void
+queuebuf(struct interface *ifp)
+{
+    struct send_queue *sendq;
+    struct queued_packet *q;
+    unsigned char *packet;
+    int hello;
+
+    assert(ifp->buffered <= ifp->bufsize);
+
+    flushupdates(ifp);
+
+    if(ifp->buffered > 0) {
+        debugf("  (flushing %d buffered bytes on %s)\n",
+               ifp->buffered, ifp->name);
+        sendq = ifp->buffered_hello >= 0 || ifp->have_buffered_ihu ?
+            &ifp->helloq : &ifp->sendq;
+        q = sendq_slot(ifp, sendq);
+        if(q) {
+            DO_HTONS(packet_header + 2, ifp->buffered);
+            hello = ifp->buffered_hello;
+            q->time = now;
+            q->deferred = 0;
+            if(fill_rtt_message(ifp) > 0)
+                q->timestamp = sizeof(packet_header) + hello + 10;
+            else
+                q->timestamp = -1;
+            packet = (unsigned char*)(q + 1);
+            memcpy(packet, packet_header, sizeof(packet_header));
+            memcpy(packet + sizeof(packet_header),
+                   ifp->sendbuf, ifp->buffered);
+            sendq->num++;
+            ifp->max_queued = MAX(ifp->max_queued, queued_packets(ifp));
+            /* Don't delay a hello, it would skew the RTT and the link
+               quality estimation. */
+            if(sendq == &ifp->helloq || sendq->num >= BABEL_SEND_BATCH)
+                flushqueue(ifp);
+        } else {
+            ifp->dropped_packets++;
+            fprintf(stderr, "Warning: send queue full, "
+                    "dropping packet to %s.\n", ifp->name);
         }
     }
     VALGRIND_MAKE_MEM_UNDEFINED(ifp->sendbuf, ifp->bufsize);
     ifp->buffered = 0;
     ifp->buffered_hello = -1;
+    ifp->have_buffered_ihu = 0;
     ifp->have_buffered_id = 0;
     ifp->have_buffered_nh = 0;
     ifp->have_buffered_prefix = 0;
     ifp->flush_timeout.tv_sec = 0;
     ifp->flush_timeout.tv_usec = 0;
+    if(queued_packets(ifp) > 0)
+        schedule_flushqueue(ifp);
 }
 
-static void
-schedule_flush(struct interface *ifp)
-{
-    unsigned msecs = jitter(ifp, 0);
-    if(ifp->flush_timeout.tv_sec != 0 &&
-       timeval_minus_msec(&ifp->flush_timeout, &now) < msecs)
-        return;
-    set_timeout(&ifp->flush_timeout, msecs);
-}
-
-static void
-schedule_flush_now(struct interface *ifp)
+void
+flushbuf(struct interface *ifp)
 {
-    /* Almost now */
-    unsigned msecs = roughly(10);
-    if(ifp->flush_timeout.tv_sec != 0 &&
-       timeval_minus_msec(&ifp->flush_timeout, &now) < msecs)
-        return;
-    set_timeout(&ifp->flush_timeout, msecs);
+    queuebuf(ifp);
+    flushqueue(ifp);
 }
 
 static void
-schedule_unicast_flush(unsigned msecs)
+schedule_unicast_flush(struct neighbour *neigh, unsigned msecs)
 {
-    if(!unicast_neighbour)
+    if(neigh->unicast_buffered == 0)
         return;
-    if(unicast_flush_timeout.tv_sec != 0 &&
-       timeval_minus_msec(&unicast_flush_timeout, &now) < msecs)
+    if(neigh->unicast_flush_timeout.tv_sec != 0 &&
+       timeval_minus_msec(&neigh->unicast_flush_timeout, &now) < msecs)
         return;
-    unicast_flush_timeout.tv_usec = (now.tv_usec + msecs * 1000) % 1000000;
-    unicast_flush_timeout.tv_sec =
-        now.tv_sec + (now.tv_usec / 1000 + msecs) / 1000;
+    timeval_add_msec(&neigh->unicast_flush_timeout, &now, msecs);
+    timeval_min(&unicast_flush_timeout, &neigh->unicast_flush_timeout);
 }
 
 static void
 ensure_space(struct interface *ifp, int space)
 {
     if(ifp->bufsize - ifp->buffered < space)
-        flushbuf(ifp);
+        queuebuf(ifp);
 }
 
 static void
 start_message(struct interface *ifp, int type, int len)
 {
     if(ifp->bufsize - ifp->buffered < len + 2)
-        flushbuf(ifp);
+        queuebuf(ifp);
     ifp->sendbuf[ifp->buffered++] = type;
     ifp->sendbuf[ifp->buffered++] = len;
 }
@@ -972,64 +1261,71 @@ accumulate_bytes(struct interface *ifp,
     ifp->buffered += len;
 }
 
+/* Each neighbour has its own unicast buffer, allocated when the first
+   message is queued, so that messages to a given neighbour are packed
+   together however they are interleaved with messages to others. */
+
 static int
 start_unicast_message(struct neighbour *neigh, int type, int len)
 {
-    if(unicast_neighbour) {
-        if(neigh != unicast_neighbour ||
-           unicast_buffered + len + 2 >=
-           MIN(UNICAST_BUFSIZE, neigh->ifp->bufsize))
-            flush_unicast(0);
-    }
-    if(!unicast_buffer)
-        unicast_buffer = malloc(UNICAST_BUFSIZE);
-    if(!unicast_buffer) {
+    if(neigh->unicast_buffered + len + 2 >=
+       MIN(UNICAST_BUFSIZE, neigh->ifp->bufsize))
+        flush_unicast(neigh, 0);
+    if(!neigh->unicast_buffer)
+        neigh->unicast_buffer = malloc(UNICAST_BUFSIZE);
+    if(!neigh->unicast_buffer) {
         perror("malloc(unicast_buffer)");
         return -1;
     }
 
-    unicast_neighbour = neigh;
+    if(neigh->unicast_buffered == 0) {
+        neigh->unicast_next = unicast_neighbours;
+        if(unicast_neighbours)
+            unicast_neighbours->unicast_pprev = &neigh->unicast_next;
+        neigh->unicast_pprev = &unicast_neighbours;
+        unicast_neighbours = neigh;
+    }
 
-    unicast_buffer[unicast_buffered++] = type;
-    unicast_buffer[unicast_buffered++] = len;
+    neigh->unicast_buffer[neigh->unicast_buffered++] = type;
+    neigh->unicast_buffer[neigh->unicast_buffered++] = len;
     return 1;
 }
 
 static void
 end_unicast_message(struct neighbour *neigh, int type, int bytes)
 {
-    assert(unicast_neighbour == neigh && unicast_buffered >= bytes + 2 &&
-           unicast_buffer[unicast_buffered - bytes - 2] == type &&
-           unicast_buffer[unicast_buffered - bytes - 1] == bytes);
-    schedule_unicast_flush(jitter(neigh->ifp, 0));
+    assert(neigh->unicast_buffered >= bytes + 2 &&
+           neigh->unicast_buffer[neigh->unicast_buffered - bytes - 2] == type &&
+           neigh->unicast_buffer[neigh->unicast_buffered - bytes - 1] == bytes);
+    schedule_unicast_flush(neigh, jitter(neigh->ifp, 0));
 }
 
 static void
 accumulate_unicast_byte(struct neighbour *neigh, unsigned char value)
 {
-    unicast_buffer[unicast_buffered++] = value;
+    neigh->unicast_buffer[neigh->unicast_buffered++] = value;
 }
 
 static void
 accumulate_unicast_short(struct neighbour *neigh, unsigned short value)
 {
-    DO_HTONS(unicast_buffer + unicast_buffered, value);
-    unicast_buffered += 2;
+    DO_HTONS(neigh->unicast_buffer + neigh->unicast_buffered, value);
+    neigh->unicast_buffered += 2;
 }
 
 static void
 accumulate_unicast_int(struct neighbour *neigh, unsigned int value)
 {
-    DO_HTONL(unicast_buffer + unicast_buffered, value);
-    unicast_buffered += 4;
+    DO_HTONL(neigh->unicast_buffer + neigh->unicast_buffered, value);
+    neigh->unicast_buffered += 4;
 }
 
 static void
 accumulate_unicast_bytes(struct neighbour *neigh,
                          const unsigned char *value, unsigned len)
 {
-    memcpy(unicast_buffer + unicast_buffered, value, len);
-    unicast_buffered += len;
+    memcpy(neigh->unicast_buffer + neigh->unicast_buffered, value, len);
+    neigh->unicast_buffered += len;
 }
 
 void
@@ -1042,7 +1338,7 @@ send_ack(struct neighbour *neigh, unsigned short nonce, unsigned short interval)
     accumulate_unicast_short(neigh, nonce);
     end_unicast_message(neigh, MESSAGE_ACK, 2);
     /* Roughly yields a value no larger than 3/2, so this meets the deadline */
-    schedule_unicast_flush(roughly(interval * 6));
+    schedule_unicast_flush(neigh, roughly(interval * 6));
 }
 
 void
@@ -1088,53 +1384,83 @@ send_hello(struct interface *ifp)
         send_marginal_ihu(ifp);
 }
 
+/* Queue the unicast buffer of neigh.  Unicast packets go ahead of the
+   multicast backlog, and wait for the bucket rather than being dropped. */
 void
-flush_unicast(int dofree)
+flush_unicast(struct neighbour *neigh, int dofree)
 {
-    struct sockaddr_in6 sin6;
-    int rc;
+    struct interface *ifp = neigh->ifp;
+    struct queued_packet *q;
+    unsigned char *packet;
 
-    if(unicast_buffered == 0)
+    if(neigh->unicast_buffered == 0)
         goto done;
 
-    if(!if_up(unicast_neighbour->ifp))
+    *neigh->unicast_pprev = neigh->unicast_next;
+    if(neigh->unicast_next)
+        neigh->unicast_next->unicast_pprev = neigh->unicast_pprev;
+    neigh->unicast_next = NULL;
+    neigh->unicast_pprev = NULL;
+
+    if(!if_up(ifp))
         goto done;
 
-    /* Preserve ordering of messages */
-    flushbuf(unicast_neighbour->ifp);
-
-    if(check_bucket(unicast_neighbour->ifp)) {
-        memset(&sin6, 0, sizeof(sin6));
-        sin6.sin6_family = AF_INET6;
-        memcpy(&sin6.sin6_addr, unicast_neighbour->address, 16);
-        sin6.sin6_port = htons(protocol_port);
-        sin6.sin6_scope_id = unicast_neighbour->ifp->ifindex;
-        DO_HTONS(packet_header + 2, unicast_buffered);
-        fill_rtt_message(unicast_neighbour->ifp);
-        rc = babel_send(protocol_socket,
-                        packet_header, sizeof(packet_header),
-                        unicast_buffer, unicast_buffered,
-                        (struct sockaddr*)&sin6, sizeof(sin6));
-        if(rc < 0)
-            perror("send(unicast)");
+    queuebuf(ifp);
+
+    q = sendq_slot(ifp, &ifp->unicastq);
+    if(q) {
+        DO_HTONS(packet_header + 2, neigh->unicast_buffered);
+        q->time = now;
+        q->deferred = 0;
+        q->timestamp = -1;
+        memcpy(q->address, neigh->address, 16);
+        packet = (unsigned char*)(q + 1);
+        memcpy(packet, packet_header, sizeof(packet_header));
+        memcpy(packet + sizeof(packet_header),
+               neigh->unicast_buffer, neigh->unicast_buffered);
+        ifp->unicastq.num++;
+        ifp->max_queued = MAX(ifp->max_queued, queued_packets(ifp));
     } else {
+        ifp->dropped_packets++;
         fprintf(stderr,
-                "Warning: bucket full, dropping unicast packet "
+                "Warning: send queue full, dropping unicast packet "
                 "to %s if %s.\n",
-                format_address(unicast_neighbour->address),
-                unicast_neighbour->ifp->name);
+                format_address(neigh->address), ifp->name);
     }
 
+    flushqueue(ifp);
+
  done:
-    VALGRIND_MAKE_MEM_UNDEFINED(unicast_buffer, UNICAST_BUFSIZE);
-    unicast_buffered = 0;
-    if(dofree && unicast_buffer) {
-        free(unicast_buffer);
-        unicast_buffer = NULL;
+    if(neigh->unicast_buffer)
+        VALGRIND_MAKE_MEM_UNDEFINED(neigh->unicast_buffer, UNICAST_BUFSIZE);
+    neigh->unicast_buffered = 0;
+    if(dofree && neigh->unicast_buffer) {
+        free(neigh->unicast_buffer);
+        neigh->unicast_buffer = NULL;
     }
-    unicast_neighbour = NULL;
+    neigh->unicast_flush_timeout.tv_sec = 0;
+    neigh->unicast_flush_timeout.tv_usec = 0;
+}
+
+/* Flush the unicast buffers whose timeout has expired, and recompute
+   unicast_flush_timeout. */
+void
+flush_unicasts(void)
+{
+    struct neighbour *neigh, *next;
+
     unicast_flush_timeout.tv_sec = 0;
     unicast_flush_timeout.tv_usec = 0;
+
+    neigh = unicast_neighbours;
+    while(neigh) {
+        next = neigh->unicast_next;
+        if(timeval_compare(&now, &neigh->unicast_flush_timeout) >= 0)
+            flush_unicast(neigh, 1);
+        else
+            timeval_min(&unicast_flush_timeout, &neigh->unicast_flush_timeout);
+        neigh = next;
+    }
 }
 
 static void
@@ -1169,7 +1495,7 @@ really_send_update(struct interface *ifp,
         enum prefix_status st;
         /* check if the route to send is the one with the lowest metric for
            the destination prefix/plen. */
-        stream = route_stream(1);
+        stream = route_stream_dst(prefix, plen);
         if(!stream) {
             fprintf(stderr, "Couldn't allocate route stream.\n");
             goto no_generic_announce;
@@ -1177,11 +1503,6 @@ really_send_update(struct interface *ifp,
         while(1) {
             rt = route_stream_next(stream);
             if(rt == NULL) break;
-            if(v4mapped(rt->src->prefix) != v4) continue;
-            st = prefix_cmp(rt->src->prefix, rt->src->plen,
-                            prefix, plen);
-            if(st != PST_EQUALS)
-                continue;
             st = prefix_cmp(rt->src->src_prefix, rt->src->src_plen,
                             src_prefix, src_plen);
             if(st != PST_EQUALS &&
@@ -1300,47 +1621,46 @@ really_send_update(struct interface *ifp,
     }
 }
 
-static int
-compare_buffered_updates(const void *av, const void *bv)
-{
-    const struct buffered_update *a = av, *b = bv;
-    int rc, v4a, v4b, ma, mb;
-
-    rc = memcmp(a->id, b->id, 8);
-    if(rc != 0)
-        return rc;
-
-    v4a = (a->plen >= 96 && v4mapped(a->prefix));
-    v4b = (b->plen >= 96 && v4mapped(b->prefix));
-
-    if(v4a > v4b)
-        return 1;
-    else if(v4a < v4b)
-        return -1;
+/* A buffered update, resolved to what it announces.  The key is such
+   that sorting by memcmp on it sends updates with the same router-id
+   together, IPv6 before IPv4, the router's own /128 first, then by
+   decreasing plen, by prefix and by source prefix. */
 
-    ma = (!v4a && a->plen == 128 && memcmp(a->prefix + 8, a->id, 8) == 0);
-    mb = (!v4b && b->plen == 128 && memcmp(b->prefix + 8, b->id, 8) == 0);
-
-    if(ma > mb)
-        return -1;
-    else if(mb > ma)
-        return 1;
-
-    if(a->plen < b->plen)
-        return 1;
-    else if(a->plen > b->plen)
-        return -1;
-
-    rc = memcmp(a->prefix, b->prefix, 16);
-    if(rc != 0)
-        return rc;
+struct update_entry {
+    unsigned char key[44];
+    struct buffered_update *b;
+    struct babel_route *route;
+    struct xroute *xroute;
+};
 
-    if(a->src_plen < b->src_plen)
-        return -1;
-    else if(a->src_plen > b->src_plen)
-        return 1;
+static void
+resolve_update(struct update_entry *e, struct buffered_update *b)
+{
+    const unsigned char *id;
+    int v4;
+
+    e->b = b;
+    e->xroute = find_xroute(b->prefix, b->plen, b->src_prefix, b->src_plen);
+    e->route = find_installed_route(b->prefix, b->plen,
+                                    b->src_prefix, b->src_plen);
+
+    id = e->route ? e->route->src->id : myid;
+    v4 = (b->plen >= 96 && v4mapped(b->prefix));
+
+    memcpy(e->key, id, 8);
+    e->key[8] = v4;
+    e->key[9] = !(!v4 && b->plen == 128 && memcmp(b->prefix + 8, id, 8) == 0);
+    e->key[10] = 0xFF - b->plen;
+    memcpy(e->key + 11, b->prefix, 16);
+    e->key[27] = b->src_plen;
+    memcpy(e->key + 28, b->src_prefix, 16);
+}
 
-    return memcmp(a->src_prefix, b->src_prefix, 16);
+static int
+compare_update_entries(const void *av, const void *bv)
+{
+    const struct update_entry *a = av, *b = bv;
+    return memcmp(a->key, b->key, sizeof(a->key));
 }
 
 void
@@ -1352,6 +1672,7 @@ flushupdates(struct interface *ifp)
     const unsigned char *last_src_prefix = NULL;
     unsigned char last_plen = 0xFF;
     unsigned char last_src_plen = 0xFF;
+    struct update_entry *entries, *e, entry;
     int i;
 
     if(ifp == NULL) {
@@ -1376,35 +1697,44 @@ flushupdates(struct interface *ifp)
                n, ifp->name, ifp->ifindex);
 
         /* In order to send fewer update messages, we want to send updates
-           with the same router-id together, with IPv6 going out before IPv4. */
+           with the same router-id together, with IPv6 going out before IPv4.
+           Each update is looked up once, and sorted on a precomputed key.
+           If we cannot allocate the entries, send them unsorted. */
+
+        entries = malloc(n * sizeof(struct update_entry));
+        if(entries) {
+            for(i = 0; i < n; i++)
+                resolve_update(&entries[i], &b[i]);
+            qsort(entries, n, sizeof(struct update_entry),
+                  compare_update_entries);
+        } else {
+            perror("malloc(update_entries)");
+        }
 
         for(i = 0; i < n; i++) {
-            route = find_installed_route(b[i].prefix, b[i].plen,
-                                         b[i].src_prefix, b[i].src_plen);
-            if(route)
-                memcpy(b[i].id, route->src->id, 8);
-            else
-                memcpy(b[i].id, myid, 8);
-        }
+            struct buffered_update *bu;
 
-        qsort(b, n, sizeof(struct buffered_update), compare_buffered_updates);
+            if(entries) {
+                e = &entries[i];
+            } else {
+                resolve_update(&entry, &b[i]);
+                e = &entry;
+            }
+            bu = e->b;
 
-        for(i = 0; i < n; i++) {
             /* The same update may be scheduled multiple times before it is
                sent out.  Since our buffer is now sorted, it is enough to
                compare with the previous update. */
 
             if(last_prefix &&
-               b[i].plen == last_plen &&
-               b[i].src_plen == last_src_plen &&
-               memcmp(b[i].prefix, last_prefix, 16) == 0 &&
-               memcmp(b[i].src_prefix, last_src_prefix, 16) == 0)
+               bu->plen == last_plen &&
+               bu->src_plen == last_src_plen &&
+               memcmp(bu->prefix, last_prefix, 16) == 0 &&
+               memcmp(bu->src_prefix, last_src_prefix, 16) == 0)
                 continue;
 
-            xroute = find_xroute(b[i].prefix, b[i].plen,
-                                 b[i].src_prefix, b[i].src_plen);
-            route = find_installed_route(b[i].prefix, b[i].plen,
-                                         b[i].src_prefix, b[i].src_plen);
+            xroute = e->xroute;
+            route = e->route;
 
             if(xroute && (!route || xroute->metric <= kernel_metric)) {
                 really_send_update(ifp, myid,
@@ -1440,7 +1770,7 @@ flushupdates(struct interface *ifp)
                     continue;
 
                 if(route_ifp->channel == IF_CHANNEL_NONINTERFERING) {
-                    memcpy(channels, route->channels, DIVERSITY_HOPS);
+                    memcpy(channels, route_channels(route), DIVERSITY_HOPS);
                 } else {
                     if(route_ifp->channel == IF_CHANNEL_UNKNOWN)
                         channels[0] = IF_CHANNEL_INTERFERING;
@@ -1449,7 +1779,8 @@ flushupdates(struct interface *ifp)
                                route_ifp->channel <= 255);
                         channels[0] = route_ifp->channel;
                     }
-                    memcpy(channels + 1, route->channels, DIVERSITY_HOPS - 1);
+                    memcpy(channels + 1, route_channels(route),
+                           DIVERSITY_HOPS - 1);
                 }
 
                 chlen = channels_len(channels);
@@ -1466,12 +1797,14 @@ flushupdates(struct interface *ifp)
             } else {
             /* There's no route for this prefix.  This can happen shortly
                after an xroute has been retracted, so send a retraction. */
-                really_send_update(ifp, myid, b[i].prefix, b[i].plen,
-                                   b[i].src_prefix, b[i].src_plen,
+                really_send_update(ifp, myid, bu->prefix, bu->plen,
+                                   bu->src_prefix, bu->src_plen,
                                    myseqno, INFINITY, NULL, -1);
             }
         }
         schedule_flush_now(ifp);
+        flushqueue(ifp);
+        free(entries);
     done:
         free(b);
     }
@@ -1634,9 +1967,7 @@ send_self_update(struct interface *ifp)
     struct xroute_stream *xroutes;
     if(ifp == NULL) {
         struct interface *ifp_aux;
-        FOR_ALL_INTERFACES(ifp_aux) {
-            if(!if_up(ifp_aux))
-                continue;
+        FOR_ALL_UP_INTERFACES(ifp_aux) {
             send_self_update(ifp_aux);
         }
         return;
@@ -1677,10 +2008,8 @@ send_ihu(struct neighbour *neigh, struct interface *ifp)
 
     if(neigh == NULL) {
         struct neighbour *ngh;
-        FOR_ALL_NEIGHBOURS(ngh) {
-            if(ngh->ifp == ifp)
-                send_ihu(ngh, ifp);
-        }
+        FOR_ALL_INTERFACE_NEIGHBOURS(ifp, ngh)
+            send_ihu(ngh, ifp);
         return;
     }
 
@@ -1700,7 +2029,7 @@ send_ihu(struct neighbour *neigh, struct interface *ifp)
        avoids an ARP exchange.  If we already have a unicast message queued
        for this neighbour, however, we might as well piggyback the IHU. */
     debugf("Sending %sihu %d on %s to %s.\n",
-           unicast_neighbour == neigh ? "unicast " : "",
+           neigh->unicast_buffered > 0 ? "unicast " : "",
            rxcost,
            neigh->ifp->name,
            format_address(neigh->address));
@@ -1720,8 +2049,9 @@ send_ihu(struct neighbour *neigh, struct interface *ifp)
        optional 10-bytes sub-TLV for timestamps (used to compute a RTT). */
     msglen = (ll ? 14 : 22) + (send_rtt_data ? 10 : 0);
 
-    if(unicast_neighbour != neigh) {
+    if(neigh->unicast_buffered == 0) {
         start_message(ifp, MESSAGE_IHU, msglen);
+        ifp->have_buffered_ihu = 1;
         accumulate_byte(ifp, ll ? 3 : 2);
         accumulate_byte(ifp, 0);
         accumulate_short(ifp, rxcost);
@@ -1899,9 +2229,7 @@ send_multihop_request(struct interface *ifp,
 
     if(ifp == NULL) {
         struct interface *ifp_aux;
-        FOR_ALL_INTERFACES(ifp_aux) {
-            if(!if_up(ifp_aux))
-                continue;
+        FOR_ALL_UP_INTERFACES(ifp_aux) {
             send_multihop_request(ifp_aux, prefix, plen, src_prefix, src_plen,
                                   seqno, id, hop_count);
         }
@@ -2061,10 +2389,6 @@ handle_request(struct neighbour *neigh, const unsigned char *prefix,
         return;
     }
 
-    if(request_redundant(neigh->ifp, prefix, plen, src_prefix, src_plen,
-                         seqno, id))
-        return;
-
     /* Let's try to forward this request. */
     if(route && route_metric(route) < INFINITY)
         successor = route->neigh;
@@ -2084,8 +2408,12 @@ handle_request(struct neighbour *neigh, const unsigned char *prefix,
         /* Give up */
         return;
 
+    /* Coalesce with a request already forwarded to the same successor;
+       the neighbour will be answered when the update arrives. */
+    if(!record_forwarded_request(neigh, successor, prefix, plen,
+                                 src_prefix, src_plen, seqno, id))
+        return;
+
     send_unicast_multihop_request(successor, prefix, plen, src_prefix, src_plen,
                                   seqno, id, hop_count - 1);
-    record_resend(RESEND_REQUEST, prefix, plen, src_prefix, src_plen, seqno, id,
-                  neigh->ifp, 0);
 }
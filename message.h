@@ -25,6 +25,9 @@ THE SOFTWARE.
 #define BUCKET_TOKENS_MAX 200
 #define BUCKET_TOKENS_PER_SEC 40
 
+/* The maximum number of packets in each send queue of an interface. */
+#define MAX_SENDQ 256
+
 /* A registry of assigned TLV and sub-TLV types is available at
    http://www.pps.univ-paris-diderot.fr/~jch/software/babel/babel-tlv-registry.text
 */
@@ -58,18 +61,19 @@ extern int split_horizon;
 
 extern unsigned char packet_header[4];
 
-extern struct neighbour *unicast_neighbour;
 extern struct timeval unicast_flush_timeout;
 
 void parse_packet(const unsigned char *from, struct interface *ifp,
                   const unsigned char *packet, int packetlen);
 void flushbuf(struct interface *ifp);
+void free_send_queues(struct interface *ifp);
 void flushupdates(struct interface *ifp);
 void send_ack(struct neighbour *neigh, unsigned short nonce,
               unsigned short interval);
 void send_hello_noupdate(struct interface *ifp, unsigned interval);
 void send_hello(struct interface *ifp);
-void flush_unicast(int dofree);
+void flush_unicast(struct neighbour *neigh, int dofree);
+void flush_unicasts(void);
 void send_update(struct interface *ifp, int urgent,
                  const unsigned char *prefix, unsigned char plen,
                  const unsigned char *src_prefix, unsigned char src_plen);
@@ -36,17 +36,68 @@ THE SOFTWARE.
 #include "message.h"
 #include "resend.h"
 #include "local.h"
+#include "pool.h"
 
 struct neighbour *neighs = NULL;
 
+/* Neighbours are also chained through hash_next in a hash table keyed on
+   the interface and address, since find_neighbour is called for every
+   packet that we receive.  The size is always a power of two. */
+static struct neighbour **neighbour_table = NULL;
+static int neighbour_table_size = 0;
+static int numneighs = 0;
+
+static int
+neighbour_hash(const unsigned char *address, struct interface *ifp, int size)
+{
+    unsigned long long h = (unsigned long)ifp;
+    unsigned long long w;
+    int i;
+
+    for(i = 0; i < 16; i += 8) {
+        memcpy(&w, address + i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return (h >> 32) & (size - 1);
+}
+
+static int
+resize_neighbour_table(int size)
+{
+    struct neighbour **table, *neigh;
+    int h;
+
+    table = calloc(size, sizeof(struct neighbour*));
+    if(table == NULL)
+        return -1;
+
+    FOR_ALL_NEIGHBOURS(neigh) {
+        h = neighbour_hash(neigh->address, neigh->ifp, size);
+        neigh->hash_next = table[h];
+        table[h] = neigh;
+    }
+    free(neighbour_table);
+    neighbour_table = table;
+    neighbour_table_size = size;
+    return 1;
+}
+
 static struct neighbour *
 find_neighbour_nocreate(const unsigned char *address, struct interface *ifp)
 {
     struct neighbour *neigh;
-    FOR_ALL_NEIGHBOURS(neigh) {
+
+    if(neighbour_table_size == 0)
+        return NULL;
+
+    neigh = neighbour_table[neighbour_hash(address, ifp,
+                                           neighbour_table_size)];
+    while(neigh) {
         if(memcmp(address, neigh->address, 16) == 0 &&
            neigh->ifp == ifp)
             return neigh;
+        neigh = neigh->hash_next;
     }
     return NULL;
 }
@@ -54,9 +105,12 @@ find_neighbour_nocreate(const unsigned char *address, struct interface *ifp)
 void
 flush_neighbour(struct neighbour *neigh)
 {
+    struct neighbour **p;
+
     flush_neighbour_routes(neigh);
-    if(unicast_neighbour == neigh)
-        flush_unicast(1);
+    assert(neigh->routes == NULL);
+    assert(neigh->nexthops == NULL);
+    flush_unicast(neigh, 1);
     flush_resends(neigh);
 
     if(neighs == neigh) {
@@ -67,8 +121,24 @@ flush_neighbour(struct neighbour *neigh)
             previous = previous->next;
         previous->next = neigh->next;
     }
+
+    p = &neighbour_table[neighbour_hash(neigh->address, neigh->ifp,
+                                        neighbour_table_size)];
+    while(*p != neigh)
+        p = &(*p)->hash_next;
+    *p = neigh->hash_next;
+    numneighs--;
+
+    if(neigh->ifp->neighbours == neigh) {
+        neigh->ifp->neighbours = neigh->ifp_next;
+    } else {
+        struct neighbour *previous = neigh->ifp->neighbours;
+        while(previous->ifp_next != neigh)
+            previous = previous->ifp_next;
+        previous->ifp_next = neigh->ifp_next;
+    }
     local_notify_neighbour(neigh, LOCAL_FLUSH);
-    free(neigh);
+    pool_free(neigh, sizeof(struct neighbour));
 }
 
 struct neighbour *
@@ -76,6 +146,7 @@ find_neighbour(const unsigned char *address, struct interface *ifp)
 {
     struct neighbour *neigh;
     const struct timeval zero = {0, 0};
+    int rc, h;
 
     neigh = find_neighbour_nocreate(address, ifp);
     if(neigh)
@@ -84,7 +155,15 @@ find_neighbour(const unsigned char *address, struct interface *ifp)
     debugf("Creating neighbour %s on %s.\n",
            format_address(address), ifp->name);
 
-    neigh = malloc(sizeof(struct neighbour));
+    if(numneighs >= neighbour_table_size) {
+        rc = resize_neighbour_table(MAX(2 * neighbour_table_size, 16));
+        if(rc < 0 && neighbour_table_size == 0) {
+            perror("malloc(neighbour_table)");
+            return NULL;
+        }
+    }
+
+    neigh = pool_alloc(sizeof(struct neighbour));
     if(neigh == NULL) {
         perror("malloc(neighbour)");
         return NULL;
@@ -103,8 +182,21 @@ find_neighbour(const unsigned char *address, struct interface *ifp)
     neigh->rtt = 0;
     neigh->rtt_time = zero;
     neigh->ifp = ifp;
+    neigh->routes = NULL;
+    neigh->nexthops = NULL;
+    neigh->unicast_buffer = NULL;
+    neigh->unicast_buffered = 0;
+    neigh->unicast_flush_timeout = zero;
+    neigh->unicast_next = NULL;
+    neigh->unicast_pprev = NULL;
     neigh->next = neighs;
     neighs = neigh;
+    h = neighbour_hash(address, ifp, neighbour_table_size);
+    neigh->hash_next = neighbour_table[h];
+    neighbour_table[h] = neigh;
+    numneighs++;
+    neigh->ifp_next = ifp->neighbours;
+    ifp->neighbours = neigh;
     local_notify_neighbour(neigh, LOCAL_ADD);
     send_hello(ifp);
     return neigh;
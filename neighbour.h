@@ -39,6 +39,16 @@ struct neighbour {
     unsigned int rtt;
     struct timeval rtt_time;
     struct interface *ifp;
+    struct neighbour *ifp_next;
+    struct neighbour *hash_next;
+    struct babel_route *routes;
+    struct route_nexthop *nexthops; /* see retain_nexthop */
+    /* Unicast messages to this neighbour, see start_unicast_message. */
+    unsigned char *unicast_buffer;
+    int unicast_buffered;
+    struct timeval unicast_flush_timeout;
+    struct neighbour *unicast_next;
+    struct neighbour **unicast_pprev;
 };
 
 extern struct neighbour *neighs;
@@ -46,6 +56,9 @@ extern struct neighbour *neighs;
 #define FOR_ALL_NEIGHBOURS(_neigh) \
     for(_neigh = neighs; _neigh; _neigh = _neigh->next)
 
+#define FOR_ALL_INTERFACE_NEIGHBOURS(_ifp, _neigh) \
+    for(_neigh = (_ifp)->neighbours; _neigh; _neigh = _neigh->ifp_next)
+
 int neighbour_valid(struct neighbour *neigh);
 void flush_neighbour(struct neighbour *neigh);
 struct neighbour *find_neighbour(const unsigned char *address,
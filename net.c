@@ -20,6 +20,11 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#ifdef __linux
+/* For recvmmsg and sendmmsg. */
+#define _GNU_SOURCE
+#endif
+
 #include <unistd.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -134,6 +139,56 @@ babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen)
     return rc;
 }
 
+/* Receive up to n datagrams from the non-blocking socket s.  Datagram i
+   is stored at buf + i * buflen, its length in lens[i] and its source
+   address at sins + i * slen.  Returns the number of datagrams received,
+   or -1 if none could be. */
+int
+babel_recv_multi(int s, void *buf, int buflen, void *sins, int slen,
+                 int *lens, int n)
+{
+    int i, rc;
+
+    if(n > BABEL_RECV_BATCH)
+        n = BABEL_RECV_BATCH;
+
+#if defined(__linux) && !defined(NO_RECVMMSG)
+    {
+        static int have_recvmmsg = 1;
+        struct mmsghdr msgs[BABEL_RECV_BATCH];
+        struct iovec iovecs[BABEL_RECV_BATCH];
+
+        if(have_recvmmsg) {
+            memset(msgs, 0, n * sizeof(struct mmsghdr));
+            for(i = 0; i < n; i++) {
+                iovecs[i].iov_base = (char*)buf + i * buflen;
+                iovecs[i].iov_len = buflen;
+                msgs[i].msg_hdr.msg_name = (char*)sins + i * slen;
+                msgs[i].msg_hdr.msg_namelen = slen;
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            rc = recvmmsg(s, msgs, n, 0, NULL);
+            if(rc >= 0 || errno != ENOSYS) {
+                for(i = 0; i < rc; i++)
+                    lens[i] = msgs[i].msg_len;
+                return rc;
+            }
+            have_recvmmsg = 0;
+        }
+    }
+#endif
+
+    for(i = 0; i < n; i++) {
+        rc = babel_recv(s, (char*)buf + i * buflen, buflen,
+                        (struct sockaddr*)((char*)sins + i * slen), slen);
+        if(rc < 0)
+            return i > 0 ? i : -1;
+        lens[i] = rc;
+    }
+    return n;
+}
+
 int
 babel_send(int s,
            const void *buf1, int buflen1, const void *buf2, int buflen2,
@@ -169,6 +224,83 @@ babel_send(int s,
     return rc;
 }
 
+/* Send n datagrams to the same destination.  Datagram i starts at
+   buf + i * stride and is lens[i] bytes long.  Datagrams that fail are
+   skipped; returns -1 if any did, with errno set by the last failure. */
+int
+babel_send_multi(int s, const void *buf, int stride, const int *lens, int n,
+                 const struct sockaddr *sin, int slen)
+{
+    int i, rc, err = 0;
+
+    if(n > BABEL_SEND_BATCH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if defined(__linux) && !defined(NO_SENDMMSG)
+    {
+        static int have_sendmmsg = 1;
+        struct mmsghdr msgs[BABEL_SEND_BATCH];
+        struct iovec iovecs[BABEL_SEND_BATCH];
+
+        if(have_sendmmsg) {
+            memset(msgs, 0, n * sizeof(struct mmsghdr));
+            for(i = 0; i < n; i++) {
+                iovecs[i].iov_base = (char*)buf + i * stride;
+                iovecs[i].iov_len = lens[i];
+                msgs[i].msg_hdr.msg_name = (struct sockaddr*)sin;
+                msgs[i].msg_hdr.msg_namelen = slen;
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            i = 0;
+            while(i < n) {
+                rc = sendmmsg(s, msgs + i, n - i, 0);
+                if(rc > 0) {
+                    i += rc;
+                } else if(errno == EINTR) {
+                    continue;
+                } else if(errno == EAGAIN) {
+                    rc = wait_for_fd(1, s, 5);
+                    if(rc <= 0) {
+                        /* Give up on the rest, as babel_send would. */
+                        errno = EAGAIN;
+                        return -1;
+                    }
+                } else if(errno == ENOSYS && i == 0) {
+                    have_sendmmsg = 0;
+                    break;
+                } else {
+                    /* The first remaining datagram failed. */
+                    err = errno;
+                    i++;
+                }
+            }
+            if(have_sendmmsg) {
+                if(err) {
+                    errno = err;
+                    return -1;
+                }
+                return n;
+            }
+        }
+    }
+#endif
+
+    for(i = 0; i < n; i++) {
+        rc = babel_send(s, (char*)buf + i * stride, lens[i], NULL, 0,
+                        sin, slen);
+        if(rc < 0)
+            err = errno;
+    }
+    if(err) {
+        errno = err;
+        return -1;
+    }
+    return n;
+}
+
 int
 tcp_server_socket(int port, int local)
 {
@@ -20,9 +20,28 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+/* The maximum number of datagrams received or sent in one go.  Receiving
+   16 at a time takes most of the gain over one recvmsg per datagram (see
+   tests/bench_recv); a larger batch mostly costs buffer space, since the
+   receive buffer holds BABEL_RECV_BATCH packets.  Can be overridden at
+   build time with -DBABEL_RECV_BATCH=n. */
+#ifndef BABEL_RECV_BATCH
+#define BABEL_RECV_BATCH 16
+#endif
+
+/* Likewise for sending (see tests/bench_send).  The send queues start
+   with room for one batch. */
+#ifndef BABEL_SEND_BATCH
+#define BABEL_SEND_BATCH 16
+#endif
+
 int babel_socket(int port);
 int babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen);
+int babel_recv_multi(int s, void *buf, int buflen, void *sins, int slen,
+                     int *lens, int n);
 int babel_send(int s,
                const void *buf1, int buflen1, const void *buf2, int buflen2,
                const struct sockaddr *sin, int slen);
+int babel_send_multi(int s, const void *buf, int stride, const int *lens, int n,
+                     const struct sockaddr *sin, int slen);
 int tcp_server_socket(int port, int local);
@@ -0,0 +1,190 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "babeld.h"
+#include "pool.h"
+
+#ifndef NO_POOL
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define POOL_GRANULE 16
+#define POOL_CLASSES 16         /* objects of up to 256 bytes */
+#define POOL_MIN_PAGE_SIZE 4096
+
+/* Every page starts with this header, and is aligned on page_size so that
+   the header of an object can be found by masking its address. */
+
+struct pool_page {
+    struct pool_page *next, *prev; /* pages of this class with free space */
+    void *free;                    /* freed objects */
+    unsigned int bump;             /* offset of the never allocated space */
+    unsigned int used;
+    int class;
+};
+
+#define PAGE_HEADER_SIZE \
+    ((sizeof(struct pool_page) + POOL_GRANULE - 1) & ~(POOL_GRANULE - 1))
+
+static struct pool_page *pool_pages[POOL_CLASSES];
+static size_t page_size = 0;
+
+static struct pool_page *
+pool_page(void *p)
+{
+    return (struct pool_page*)((unsigned long)p & ~(page_size - 1));
+}
+
+static void
+link_page(struct pool_page *page)
+{
+    page->prev = NULL;
+    page->next = pool_pages[page->class];
+    if(page->next)
+        page->next->prev = page;
+    pool_pages[page->class] = page;
+}
+
+static void
+unlink_page(struct pool_page *page)
+{
+    if(page->prev)
+        page->prev->next = page->next;
+    else
+        pool_pages[page->class] = page->next;
+    if(page->next)
+        page->next->prev = page->prev;
+    page->next = page->prev = NULL;
+}
+
+static struct pool_page *
+new_page(int class)
+{
+    struct pool_page *page;
+
+    if(page_size == 0) {
+        long ps = sysconf(_SC_PAGESIZE);
+        page_size = ps > POOL_MIN_PAGE_SIZE ? ps : POOL_MIN_PAGE_SIZE;
+    }
+
+    page = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(page == MAP_FAILED)
+        return NULL;
+
+    /* mmap only guarantees alignment on the system page size. */
+    assert(pool_page(page) == page);
+
+    page->free = NULL;
+    page->bump = PAGE_HEADER_SIZE;
+    page->used = 0;
+    page->class = class;
+    link_page(page);
+    return page;
+}
+
+void *
+pool_alloc(size_t size)
+{
+    struct pool_page *page;
+    size_t object_size;
+    void *p;
+    int class;
+
+    if(size == 0 || size > POOL_CLASSES * POOL_GRANULE)
+        return malloc(size);
+
+    class = (size - 1) / POOL_GRANULE;
+    object_size = (class + 1) * POOL_GRANULE;
+
+    page = pool_pages[class];
+    if(page == NULL) {
+        page = new_page(class);
+        if(page == NULL)
+            return NULL;
+    }
+
+    if(page->free) {
+        p = page->free;
+        page->free = *(void**)p;
+    } else {
+        p = (unsigned char*)page + page->bump;
+        page->bump += object_size;
+    }
+    page->used++;
+
+    if(page->free == NULL && page->bump + object_size > page_size)
+        /* Page full. */
+        unlink_page(page);
+
+    VALGRIND_MAKE_MEM_UNDEFINED(p, size);
+    return p;
+}
+
+void
+pool_free(void *p, size_t size)
+{
+    struct pool_page *page;
+    size_t object_size;
+    int full;
+
+    if(p == NULL)
+        return;
+
+    if(size == 0 || size > POOL_CLASSES * POOL_GRANULE) {
+        free(p);
+        return;
+    }
+
+    page = pool_page(p);
+    object_size = (page->class + 1) * POOL_GRANULE;
+    assert(page->class == (size - 1) / POOL_GRANULE);
+    assert(page->used > 0);
+
+    full = page->free == NULL && page->bump + object_size > page_size;
+    *(void**)p = page->free;
+    page->free = p;
+    page->used--;
+
+    if(full)
+        link_page(page);
+
+    /* Give the page back, unless it's the only one with free space left,
+       which avoids thrashing when a single object comes and goes. */
+    if(page->used == 0 && (page->next || page->prev)) {
+        unlink_page(page);
+        munmap(page, page_size);
+    }
+}
+
+#endif
@@ -0,0 +1,40 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Allocator for the small objects that come and go with the routing
+   table.  Objects are carved out of pages dedicated to a single size
+   class, and a page is given back to the system as soon as it is empty.
+   The size passed to pool_free must be the one passed to pool_alloc.
+   Define NO_POOL to use malloc instead, e.g. when running under
+   valgrind. */
+
+#ifdef NO_POOL
+
+#define pool_alloc(_size) malloc(_size)
+#define pool_free(_p, _size) free(_p)
+
+#else
+
+void *pool_alloc(size_t size);
+void pool_free(void *p, size_t size);
+
+#endif
@@ -20,6 +20,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <stdio.h>
 #include <sys/time.h>
 #include <time.h>
 #include <string.h>
@@ -34,7 +35,37 @@ THE SOFTWARE.
 #include "configuration.h"
 
 struct timeval resend_time = {0, 0};
-struct resend *to_resend = NULL;
+
+/* Pending resends are kept in a chained hash table indexed by kind and
+   prefix.  Those that are due to be resent are also kept in a binary
+   min-heap ordered by deadline, so that resend_time is the deadline of
+   the root. */
+
+static struct resend **resend_table = NULL;
+static int resend_table_size = 0, numresends = 0;
+
+static struct resend **resend_heap = NULL;
+static int resend_heap_size = 0, resend_heap_max = 0;
+
+static int
+resend_hash(int kind, const unsigned char *prefix, unsigned char plen,
+            const unsigned char *src_prefix, unsigned char src_plen,
+            int size)
+{
+    unsigned long long h = kind | (plen << 8) | (src_plen << 16);
+    unsigned long long w;
+    int i;
+
+    for(i = 0; i < 16; i += 8) {
+        memcpy(&w, prefix + i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+        memcpy(&w, src_prefix + i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return (h >> 32) & (size - 1);
+}
 
 static int
 resend_match(struct resend *resend,
@@ -47,30 +78,228 @@ resend_match(struct resend *resend,
             memcmp(resend->src_prefix, src_prefix, 16) == 0);
 }
 
+static int
+resize_resend_table(int size)
+{
+    struct resend **table, *resend;
+    int i, h;
+
+    table = calloc(size, sizeof(struct resend*));
+    if(table == NULL)
+        return -1;
+
+    for(i = 0; i < resend_table_size; i++) {
+        while((resend = resend_table[i]) != NULL) {
+            resend_table[i] = resend->next;
+            h = resend_hash(resend->kind, resend->prefix, resend->plen,
+                            resend->src_prefix, resend->src_plen, size);
+            resend->next = table[h];
+            table[h] = resend;
+        }
+    }
+    free(resend_table);
+    resend_table = table;
+    resend_table_size = size;
+    return 1;
+}
+
+static int
+heap_before(int i, int j)
+{
+    return timeval_compare(&resend_heap[i]->deadline,
+                           &resend_heap[j]->deadline) < 0;
+}
+
+static void
+heap_set(int i, struct resend *resend)
+{
+    resend_heap[i] = resend;
+    resend->heap_index = i;
+}
+
+static void
+heap_swap(int i, int j)
+{
+    struct resend *resend = resend_heap[i];
+    heap_set(i, resend_heap[j]);
+    heap_set(j, resend);
+}
+
+static void
+heap_up(int i)
+{
+    while(i > 0 && heap_before(i, (i - 1) / 2)) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void
+heap_down(int i)
+{
+    int child;
+
+    while((child = 2 * i + 1) < resend_heap_size) {
+        if(child + 1 < resend_heap_size && heap_before(child + 1, child))
+            child++;
+        if(!heap_before(child, i))
+            break;
+        heap_swap(i, child);
+        i = child;
+    }
+}
+
+static void
+heap_remove(struct resend *resend)
+{
+    int i = resend->heap_index;
+
+    if(i < 0)
+        return;
+
+    resend->heap_index = -1;
+    resend_heap_size--;
+    if(i < resend_heap_size) {
+        heap_set(i, resend_heap[resend_heap_size]);
+        heap_up(i);
+        heap_down(i);
+    }
+}
+
+static int
+heap_insert(struct resend *resend)
+{
+    if(resend_heap_size >= resend_heap_max) {
+        struct resend **heap;
+        int n = MAX(2 * resend_heap_max, 16);
+        heap = realloc(resend_heap, n * sizeof(struct resend*));
+        if(heap == NULL)
+            return -1;
+        resend_heap = heap;
+        resend_heap_max = n;
+    }
+    heap_set(resend_heap_size, resend);
+    resend_heap_size++;
+    heap_up(resend->heap_index);
+    return 1;
+}
+
+static int
+resend_expired(struct resend *resend)
+{
+    switch(resend->kind) {
+    case RESEND_REQUEST:
+        return timeval_minus_msec(&now, &resend->time) >= REQUEST_TIMEOUT;
+    default:
+        return resend->max <= 0;
+    }
+}
+
+/* Puts a resend in the heap if it will be resent, at the position given
+   by its deadline, and removes it otherwise. */
+static void
+schedule_resend(struct resend *resend)
+{
+    if(resend_expired(resend) || resend->delay == 0 || resend->max <= 0) {
+        heap_remove(resend);
+        return;
+    }
+
+    timeval_add_msec(&resend->deadline, &resend->time, resend->delay);
+    if(resend->heap_index >= 0) {
+        heap_up(resend->heap_index);
+        heap_down(resend->heap_index);
+    } else if(heap_insert(resend) < 0) {
+        perror("realloc(resend_heap)");
+    }
+}
+
+static void
+add_requester(struct resend *request, struct neighbour *neigh)
+{
+    struct resend_requester *requester;
+
+    if(request->ifp != neigh->ifp)
+        request->ifp = NULL;
+
+    for(requester = request->requesters; requester;
+        requester = requester->next) {
+        if(requester->neigh == neigh)
+            return;
+    }
+
+    requester = malloc(sizeof(struct resend_requester));
+    if(requester == NULL) {
+        perror("malloc(requester)");
+        return;
+    }
+    requester->neigh = neigh;
+    requester->next = request->requesters;
+    request->requesters = requester;
+}
+
+/* Forget the requesters that are on a given interface, or all of them if
+   ifp is NULL.  Returns the number of requesters that were removed. */
+static int
+flush_requesters(struct resend *request, struct interface *ifp)
+{
+    struct resend_requester **p, *requester;
+    int n = 0;
+
+    p = &request->requesters;
+    while((requester = *p) != NULL) {
+        if(ifp == NULL || requester->neigh->ifp == ifp) {
+            *p = requester->next;
+            free(requester);
+            n++;
+        } else {
+            p = &requester->next;
+        }
+    }
+    return n;
+}
+
 /* This is called by neigh.c when a neighbour is flushed */
 
 void
 flush_resends(struct neighbour *neigh)
 {
-    /* Nothing for now */
+    struct resend *resend;
+    struct resend_requester **p, *requester;
+    int i;
+
+    for(i = 0; i < resend_table_size; i++) {
+        for(resend = resend_table[i]; resend; resend = resend->next) {
+            if(resend->successor == neigh)
+                resend->successor = NULL;
+            p = &resend->requesters;
+            while((requester = *p) != NULL) {
+                if(requester->neigh == neigh) {
+                    *p = requester->next;
+                    free(requester);
+                } else {
+                    p = &requester->next;
+                }
+            }
+        }
+    }
 }
 
 static struct resend *
 find_resend(int kind, const unsigned char *prefix, unsigned char plen,
-            const unsigned char *src_prefix, unsigned char src_plen,
-            struct resend **previous_return)
+            const unsigned char *src_prefix, unsigned char src_plen)
 {
-    struct resend *current, *previous;
+    struct resend *current;
 
-    previous = NULL;
-    current = to_resend;
+    if(resend_table_size == 0)
+        return NULL;
+
+    current = resend_table[resend_hash(kind, prefix, plen,
+                                       src_prefix, src_plen,
+                                       resend_table_size)];
     while(current) {
-        if(resend_match(current, kind, prefix, plen, src_prefix, src_plen)) {
-            if(previous_return)
-                *previous_return = previous;
+        if(resend_match(current, kind, prefix, plen, src_prefix, src_plen))
             return current;
-        }
-        previous = current;
         current = current->next;
     }
 
@@ -79,11 +308,9 @@ find_resend(int kind, const unsigned char *prefix, unsigned char plen,
 
 struct resend *
 find_request(const unsigned char *prefix, unsigned char plen,
-             const unsigned char *src_prefix, unsigned char src_plen,
-             struct resend **previous_return)
+             const unsigned char *src_prefix, unsigned char src_plen)
 {
-    return find_resend(RESEND_REQUEST, prefix, plen, src_prefix, src_plen,
-                       previous_return);
+    return find_resend(RESEND_REQUEST, prefix, plen, src_prefix, src_plen);
 }
 
 int
@@ -94,6 +321,7 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
 {
     struct resend *resend;
     unsigned int ifindex = ifp ? ifp->ifindex : 0;
+    int h;
 
     if((kind == RESEND_REQUEST &&
         input_filter(NULL, prefix, plen, src_prefix, src_plen, NULL,
@@ -108,7 +336,7 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
     if(delay >= 0xFFFF)
         delay = 0xFFFF;
 
-    resend = find_resend(kind, prefix, plen, src_prefix, src_plen, NULL);
+    resend = find_resend(kind, prefix, plen, src_prefix, src_plen);
     if(resend) {
         if(resend->delay && delay)
             resend->delay = MIN(resend->delay, delay);
@@ -118,6 +346,8 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
         resend->max = RESEND_MAX;
         if(id && memcmp(resend->id, id, 8) == 0 &&
            seqno_compare(resend->seqno, seqno) > 0) {
+            schedule_resend(resend);
+            recompute_resend_time();
             return 0;
         }
         if(id)
@@ -128,6 +358,10 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
         if(resend->ifp != ifp)
             resend->ifp = NULL;
     } else {
+        if(numresends >= resend_table_size) {
+            if(resize_resend_table(MAX(2 * resend_table_size, 16)) < 0)
+                return -1;
+        }
         resend = malloc(sizeof(struct resend));
         if(resend == NULL)
             return -1;
@@ -144,28 +378,58 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
         else
             memset(resend->id, 0, 8);
         resend->ifp = ifp;
+        resend->successor = NULL;
+        resend->requesters = NULL;
         resend->time = now;
-        resend->next = to_resend;
-        to_resend = resend;
+        resend->heap_index = -1;
+        h = resend_hash(kind, prefix, plen, src_prefix, src_plen,
+                        resend_table_size);
+        resend->next = resend_table[h];
+        resend_table[h] = resend;
+        numresends++;
     }
 
-    if(resend->delay) {
-        struct timeval timeout;
-        timeval_add_msec(&timeout, &resend->time, resend->delay);
-        timeval_min(&resend_time, &timeout);
-    }
+    schedule_resend(resend);
+    recompute_resend_time();
     return 1;
 }
 
-static int
-resend_expired(struct resend *resend)
+/* Called when requester asks us to forward a request that we would forward
+   to successor.  Returns 1 if the request should be sent, and 0 if it
+   can be coalesced with one that we have already forwarded. */
+int
+record_forwarded_request(struct neighbour *requester,
+                         struct neighbour *successor,
+                         const unsigned char *prefix, unsigned char plen,
+                         const unsigned char *src_prefix,
+                         unsigned char src_plen,
+                         unsigned short seqno, const unsigned char *id)
 {
-    switch(resend->kind) {
-    case RESEND_REQUEST:
-        return timeval_minus_msec(&now, &resend->time) >= REQUEST_TIMEOUT;
-    default:
-        return resend->max <= 0;
+    struct resend *request;
+
+    request = find_request(prefix, plen, src_prefix, src_plen);
+    if(request && !resend_expired(request) &&
+       request->successor == successor &&
+       memcmp(request->id, id, 8) == 0 &&
+       seqno_compare(request->seqno, seqno) >= 0) {
+        add_requester(request, requester);
+        return 0;
     }
+
+    if(request_redundant(requester->ifp, prefix, plen, src_prefix, src_plen,
+                         seqno, id)) {
+        add_requester(request, requester);
+        return 0;
+    }
+
+    record_resend(RESEND_REQUEST, prefix, plen, src_prefix, src_plen,
+                  seqno, id, requester->ifp, 0);
+    request = find_request(prefix, plen, src_prefix, src_plen);
+    if(request) {
+        request->successor = successor;
+        add_requester(request, requester);
+    }
+    return 1;
 }
 
 int
@@ -175,7 +439,7 @@ unsatisfied_request(const unsigned char *prefix, unsigned char plen,
 {
     struct resend *request;
 
-    request = find_request(prefix, plen, src_prefix, src_plen, NULL);
+    request = find_request(prefix, plen, src_prefix, src_plen);
     if(request == NULL || resend_expired(request))
         return 0;
 
@@ -195,7 +459,7 @@ request_redundant(struct interface *ifp,
 {
     struct resend *request;
 
-    request = find_request(prefix, plen, src_prefix, src_plen, NULL);
+    request = find_request(prefix, plen, src_prefix, src_plen);
     if(request == NULL || resend_expired(request))
         return 0;
 
@@ -224,21 +488,30 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
                 unsigned short seqno, const unsigned char *id,
                 struct interface *ifp)
 {
-    struct resend *request, *previous;
+    struct resend *request;
 
-    request = find_request(prefix, plen, src_prefix, src_plen, &previous);
+    request = find_request(prefix, plen, src_prefix, src_plen);
     if(request == NULL)
         return 0;
 
-    if(ifp != NULL && request->ifp != ifp)
+    if(request->requesters == NULL && ifp != NULL && request->ifp != ifp)
         return 0;
 
     if(memcmp(request->id, id, 8) != 0 ||
        seqno_compare(request->seqno, seqno) <= 0) {
-        /* We cannot remove the request, as we may be walking the list right
-           now.  Mark it as expired, so that expire_resend will remove it. */
+        if(request->requesters) {
+            /* A forwarded request is satisfied once the update has been
+               sent on the interfaces of all the neighbours that asked. */
+            if(flush_requesters(request, ifp) == 0)
+                return 0;
+            if(request->requesters)
+                return 1;
+        }
+        /* We cannot free the request, as do_resend may be using it right
+           now.  Mark it as expired, so that expire_resend will free it. */
         request->max = 0;
         request->time.tv_sec = 0;
+        heap_remove(request);
         recompute_resend_time();
         return 1;
     }
@@ -246,52 +519,70 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
     return 0;
 }
 
+/* Send an urgent update for a forwarded request on the interfaces of the
+   neighbours that asked for it.  Returns the number of interfaces, which
+   is 0 if nobody asked. */
+int
+send_update_requesters(const unsigned char *prefix, unsigned char plen,
+                       const unsigned char *src_prefix, unsigned char src_plen)
+{
+    struct resend *request;
+    struct resend_requester *requester;
+    struct interface *ifp;
+    int n = 0;
+
+    request = find_request(prefix, plen, src_prefix, src_plen);
+    if(request == NULL || resend_expired(request))
+        return 0;
+
+    /* send_update may flush, which may satisfy the request and free
+       requesters, so look at the list afresh for every interface. */
+    FOR_ALL_INTERFACES(ifp) {
+        for(requester = request->requesters; requester;
+            requester = requester->next) {
+            if(requester->neigh->ifp == ifp)
+                break;
+        }
+        if(requester) {
+            send_update(ifp, 1, prefix, plen, src_prefix, src_plen);
+            n++;
+        }
+    }
+    return n;
+}
+
 void
 expire_resend()
 {
-    struct resend *current, *previous;
-    int recompute = 0;
-
-    previous = NULL;
-    current = to_resend;
-    while(current) {
-        if(resend_expired(current)) {
-            if(previous == NULL) {
-                to_resend = current->next;
+    struct resend **p, *current;
+    int i;
+
+    for(i = 0; i < resend_table_size; i++) {
+        p = &resend_table[i];
+        while((current = *p) != NULL) {
+            if(resend_expired(current)) {
+                *p = current->next;
+                heap_remove(current);
+                flush_requesters(current, NULL);
                 free(current);
-                current = to_resend;
+                numresends--;
             } else {
-                previous->next = current->next;
-                free(current);
-                current = previous->next;
+                p = &current->next;
             }
-            recompute = 1;
-        } else {
-            previous = current;
-            current = current->next;
         }
     }
-    if(recompute)
-        recompute_resend_time();
+    recompute_resend_time();
 }
 
 void
 recompute_resend_time()
 {
-    struct resend *request;
-    struct timeval resend = {0, 0};
-
-    request = to_resend;
-    while(request) {
-        if(!resend_expired(request) && request->delay > 0 && request->max > 0) {
-            struct timeval timeout;
-            timeval_add_msec(&timeout, &request->time, request->delay);
-            timeval_min(&resend, &timeout);
-        }
-        request = request->next;
+    if(resend_heap_size > 0) {
+        resend_time = resend_heap[0]->deadline;
+    } else {
+        resend_time.tv_sec = 0;
+        resend_time.tv_usec = 0;
     }
-
-    resend_time = resend;
 }
 
 void
@@ -299,31 +590,35 @@ do_resend()
 {
     struct resend *resend;
 
-    resend = to_resend;
-    while(resend) {
-        if(!resend_expired(resend) && resend->delay > 0 && resend->max > 0) {
-            struct timeval timeout;
-            timeval_add_msec(&timeout, &resend->time, resend->delay);
-            if(timeval_compare(&now, &timeout) >= 0) {
-                switch(resend->kind) {
-                case RESEND_REQUEST:
-                    send_multihop_request(resend->ifp,
-                                          resend->prefix, resend->plen,
-                                          resend->src_prefix, resend->src_plen,
-                                          resend->seqno, resend->id, 127);
-                    break;
-                case RESEND_UPDATE:
-                    send_update(resend->ifp, 1,
-                                resend->prefix, resend->plen,
-                                resend->src_prefix, resend->src_plen);
-                    break;
-                default: abort();
-                }
-                resend->delay = MIN(0xFFFF, resend->delay * 2);
-                resend->max--;
-            }
+    while(resend_heap_size > 0 &&
+          timeval_compare(&now, &resend_heap[0]->deadline) >= 0) {
+        resend = resend_heap[0];
+        heap_remove(resend);
+        if(resend_expired(resend))
+            continue;
+        switch(resend->kind) {
+        case RESEND_REQUEST:
+            send_multihop_request(resend->ifp,
+                                  resend->prefix, resend->plen,
+                                  resend->src_prefix, resend->src_plen,
+                                  resend->seqno, resend->id, 127);
+            break;
+        case RESEND_UPDATE:
+            send_update(resend->ifp, 1,
+                        resend->prefix, resend->plen,
+                        resend->src_prefix, resend->src_plen);
+            break;
+        default: abort();
+        }
+        resend->delay = MIN(0xFFFF, resend->delay * 2);
+        resend->max--;
+        schedule_resend(resend);
+        /* Don't resend twice in a row if we have fallen behind. */
+        if(resend->heap_index >= 0 &&
+           timeval_compare(&now, &resend->deadline) >= 0) {
+            timeval_add_msec(&resend->deadline, &now, 1);
+            heap_down(resend->heap_index);
         }
-        resend = resend->next;
     }
     recompute_resend_time();
 }
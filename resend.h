@@ -26,6 +26,12 @@ THE SOFTWARE.
 #define RESEND_REQUEST 1
 #define RESEND_UPDATE 2
 
+/* A neighbour that asked us to forward a request. */
+struct resend_requester {
+    struct neighbour *neigh;
+    struct resend_requester *next;
+};
+
 struct resend {
     unsigned char kind;
     unsigned char max;
@@ -38,19 +44,28 @@ struct resend {
     unsigned short seqno;
     unsigned char id[8];
     struct interface *ifp;
-    struct resend *next;
+    struct neighbour *successor;    /* where a request was forwarded */
+    struct resend_requester *requesters;
+    struct timeval deadline;    /* time + delay */
+    int heap_index;             /* -1 if not scheduled */
+    struct resend *next;        /* hash chain */
 };
 
 extern struct timeval resend_time;
 
 struct resend *find_request(const unsigned char *prefix, unsigned char plen,
-                    const unsigned char *src_prefix, unsigned char src_plen,
-                    struct resend **previous_return);
+                    const unsigned char *src_prefix, unsigned char src_plen);
 void flush_resends(struct neighbour *neigh);
 int record_resend(int kind, const unsigned char *prefix, unsigned char plen,
                   const unsigned char *src_prefix, unsigned char src_plen,
                   unsigned short seqno, const unsigned char *id,
                   struct interface *ifp, int delay);
+int record_forwarded_request(struct neighbour *requester,
+                             struct neighbour *successor,
+                             const unsigned char *prefix, unsigned char plen,
+                             const unsigned char *src_prefix,
+                             unsigned char src_plen,
+                             unsigned short seqno, const unsigned char *id);
 int unsatisfied_request(const unsigned char *prefix, unsigned char plen,
                         const unsigned char *src_prefix, unsigned char src_plen,
                         unsigned short seqno, const unsigned char *id);
@@ -62,6 +77,9 @@ int satisfy_request(const unsigned char *prefix, unsigned char plen,
                     const unsigned char *src_prefix, unsigned char src_plen,
                     unsigned short seqno, const unsigned char *id,
                     struct interface *ifp);
+int send_update_requesters(const unsigned char *prefix, unsigned char plen,
+                           const unsigned char *src_prefix,
+                           unsigned char src_plen);
 
 void expire_resend(void);
 void recompute_resend_time(void);
@@ -34,15 +34,17 @@ THE SOFTWARE.
 #include "source.h"
 #include "neighbour.h"
 #include "route.h"
+#include "trie.h"
 #include "xroute.h"
 #include "message.h"
 #include "resend.h"
 #include "configuration.h"
 #include "local.h"
 #include "disambiguation.h"
+#include "pool.h"
 
-struct babel_route **routes = NULL;
-static int route_slots = 0, max_route_slots = 0;
+static struct trie_node *route_trie = NULL;
+static int route_slots = 0;
 int kernel_metric = 0, reflect_kernel_metric = 0;
 int allow_duplicates = -1;
 int diversity_kind = DIVERSITY_NONE;
@@ -52,75 +54,30 @@ int keep_unfeasible = 0;
 #define IP6_RT_PRIO_USER 1024 //from linux/ipv6_route.h, used as default kernel metric
 
 static int smoothing_half_life = 0;
-static int two_to_the_one_over_hl = 0; /* 2^(1/hl) * 0x10000 */
+static unsigned int exp2_table[256]; /* 2^(-i/256) * 0x10000 */
 
-/* We maintain a list of "slots", ordered by prefix.  Every slot
-   contains a linked list of the routes to this prefix, with the
-   installed route, if any, at the head of the list. */
+/* We maintain a trie of "slots", indexed by destination prefix.  Every node
+   of this trie holds a second trie indexed by source prefix, whose nodes
+   contain a linked list of the routes to this (destination, source) pair,
+   with the installed route, if any, at the head of the list.  A slot
+   holds an installed route exactly when the head of its list has
+   installed set.  Installed routes are marked with trie_count in both
+   tries, so that the installed routes can be enumerated without visiting
+   the other slots. */
 
-static int
-route_compare(const unsigned char *prefix, unsigned char plen,
-              const unsigned char *src_prefix, unsigned char src_plen,
-              struct babel_route *route)
-{
-    int i = memcmp(prefix, route->src->prefix, 16);
-    if(i != 0)
-        return i;
-
-    if(plen < route->src->plen)
-        return -1;
-    if(plen > route->src->plen)
-        return 1;
-
-    if(src_plen == 0) {
-        if(route->src->src_plen > 0)
-            return -1;
-    } else {
-        i = memcmp(src_prefix, route->src->src_prefix, 16);
-        if(i != 0)
-            return i;
-        if(src_plen < route->src->src_plen)
-            return -1;
-        if(src_plen > route->src->src_plen)
-            return 1;
-    }
-
-    return 0;
-}
-
-/* Performs binary search, returns -1 in case of failure.  In the latter
-   case, new_return is the place where to insert the new element. */
+#define slot_installed(_slot) \
+    ((_slot)->data && ((struct babel_route*)(_slot)->data)->installed)
 
-static int
+static struct trie_node *
 find_route_slot(const unsigned char *prefix, unsigned char plen,
-                const unsigned char *src_prefix, unsigned char src_plen,
-                int *new_return)
+                const unsigned char *src_prefix, unsigned char src_plen)
 {
-    int p, m, g, c;
+    struct trie_node *dst = trie_find(route_trie, prefix, plen);
 
-    if(route_slots < 1) {
-        if(new_return)
-            *new_return = 0;
-        return -1;
-    }
-
-    p = 0; g = route_slots - 1;
+    if(dst == NULL)
+        return NULL;
 
-    do {
-        m = (p + g) / 2;
-        c = route_compare(prefix, plen, src_prefix, src_plen, routes[m]);
-        if(c == 0)
-            return m;
-        else if(c < 0)
-            g = m - 1;
-        else
-            p = m + 1;
-    } while(p <= g);
-
-    if(new_return)
-        *new_return = p;
-
-    return -1;
+    return trie_find(dst->sub, src_prefix, src_plen);
 }
 
 struct babel_route *
@@ -129,12 +86,13 @@ find_route(const unsigned char *prefix, unsigned char plen,
            struct neighbour *neigh, const unsigned char *nexthop)
 {
     struct babel_route *route;
-    int i = find_route_slot(prefix, plen, src_prefix, src_plen, NULL);
+    struct trie_node *slot =
+        find_route_slot(prefix, plen, src_prefix, src_plen);
 
-    if(i < 0)
+    if(slot == NULL)
         return NULL;
 
-    route = routes[i];
+    route = slot->data;
 
     while(route) {
         if(route->neigh == neigh && memcmp(route->nexthop, nexthop, 16) == 0)
@@ -149,80 +107,347 @@ struct babel_route *
 find_installed_route(const unsigned char *prefix, unsigned char plen,
                      const unsigned char *src_prefix, unsigned char src_plen)
 {
-    int i = find_route_slot(prefix, plen, src_prefix, src_plen, NULL);
+    struct trie_node *slot =
+        find_route_slot(prefix, plen, src_prefix, src_plen);
+    struct babel_route *route = slot ? slot->data : NULL;
 
-    if(i >= 0 && routes[i]->installed)
-        return routes[i];
+    if(route && route->installed)
+        return route;
 
     return NULL;
 }
 
-/* Returns an overestimate of the number of installed routes. */
-int
-installed_routes_estimate(void)
+static void
+link_neighbour_route(struct babel_route *route)
 {
-    return route_slots;
+    struct neighbour *neigh = route->neigh;
+
+    route->neigh_prev = NULL;
+    route->neigh_next = neigh->routes;
+    if(neigh->routes)
+        neigh->routes->neigh_prev = route;
+    neigh->routes = route;
+}
+
+static void
+unlink_neighbour_route(struct babel_route *route)
+{
+    if(route->neigh_prev)
+        route->neigh_prev->neigh_next = route->neigh_next;
+    else
+        route->neigh->routes = route->neigh_next;
+    if(route->neigh_next)
+        route->neigh_next->neigh_prev = route->neigh_prev;
+    route->neigh_next = route->neigh_prev = NULL;
+}
+
+/* Next hops other than the neighbour's address, typically its IPv4
+   address, are shared between the routes through that neighbour. */
+
+struct route_nexthop {
+    struct route_nexthop *next;
+    unsigned char address[16];
+    int refcount;
+};
+
+static const unsigned char *
+retain_nexthop(struct neighbour *neigh, const unsigned char *nexthop)
+{
+    struct route_nexthop *nh;
+
+    if(memcmp(nexthop, neigh->address, 16) == 0)
+        return neigh->address;
+
+    for(nh = neigh->nexthops; nh; nh = nh->next) {
+        if(memcmp(nh->address, nexthop, 16) == 0) {
+            nh->refcount++;
+            return nh->address;
+        }
+    }
+
+    nh = pool_alloc(sizeof(struct route_nexthop));
+    if(nh == NULL) {
+        perror("malloc(nexthop)");
+        return NULL;
+    }
+    memcpy(nh->address, nexthop, 16);
+    nh->refcount = 1;
+    nh->next = neigh->nexthops;
+    neigh->nexthops = nh;
+    return nh->address;
 }
 
+static void
+release_nexthop(struct neighbour *neigh, const unsigned char *nexthop)
+{
+    struct route_nexthop **p, *nh;
+
+    if(nexthop == neigh->address)
+        return;
+
+    for(p = &neigh->nexthops; *p; p = &(*p)->next) {
+        nh = *p;
+        if(nh->address == nexthop) {
+            if(--nh->refcount == 0) {
+                *p = nh->next;
+                pool_free(nh, sizeof(struct route_nexthop));
+            }
+            return;
+        }
+    }
+    abort();
+}
+
+/* Channel lists are only sent by nodes doing diversity routing, so they
+   live in a hash table indexed by route rather than in the route itself. */
+
+struct route_channels {
+    struct route_channels *next;
+    struct babel_route *route;
+    unsigned char channels[DIVERSITY_HOPS];
+};
+
+static struct route_channels **channels_table = NULL;
+static int channels_table_size = 0, channels_count = 0;
+
+static const unsigned char no_channels[DIVERSITY_HOPS] = {0};
+
 static int
-resize_route_table(int new_slots)
+channels_hash(const struct babel_route *route, int size)
 {
-    struct babel_route **new_routes;
-    assert(new_slots >= route_slots);
+    return ((unsigned long)route / 16 * 2654435761U) & (size - 1);
+}
 
-    if(new_slots == 0) {
-        new_routes = NULL;
-        free(routes);
-    } else {
-        new_routes = realloc(routes, new_slots * sizeof(struct babel_route*));
-        if(new_routes == NULL)
-            return -1;
+static struct route_channels **
+find_channels(const struct babel_route *route)
+{
+    struct route_channels **p;
+
+    if(channels_table_size == 0)
+        return NULL;
+
+    p = &channels_table[channels_hash(route, channels_table_size)];
+    while(*p) {
+        if((*p)->route == route)
+            return p;
+        p = &(*p)->next;
     }
+    return NULL;
+}
+
+static int
+resize_channels_table(int size)
+{
+    struct route_channels **table, *rc;
+    int i, h;
+
+    table = calloc(size, sizeof(struct route_channels*));
+    if(table == NULL)
+        return -1;
 
-    max_route_slots = new_slots;
-    routes = new_routes;
+    for(i = 0; i < channels_table_size; i++) {
+        while((rc = channels_table[i]) != NULL) {
+            channels_table[i] = rc->next;
+            h = channels_hash(rc->route, size);
+            rc->next = table[h];
+            table[h] = rc;
+        }
+    }
+    free(channels_table);
+    channels_table = table;
+    channels_table_size = size;
     return 1;
 }
 
+/* Returns the channels of a route, an array of DIVERSITY_HOPS entries. */
+const unsigned char *
+route_channels(struct babel_route *route)
+{
+    struct route_channels **p;
+
+    if(!route->has_channels)
+        return no_channels;
+    p = find_channels(route);
+    assert(p != NULL);
+    return (*p)->channels;
+}
+
+static void
+flush_route_channels(struct babel_route *route)
+{
+    struct route_channels **p, *rc;
+
+    if(!route->has_channels)
+        return;
+
+    p = find_channels(route);
+    assert(p != NULL);
+    rc = *p;
+    *p = rc->next;
+    pool_free(rc, sizeof(struct route_channels));
+    channels_count--;
+    route->has_channels = 0;
+}
+
+static void
+set_route_channels(struct babel_route *route,
+                   const unsigned char *channels, int channels_len)
+{
+    struct route_channels **p, *rc;
+    int h;
+
+    channels_len = MIN(channels_len, DIVERSITY_HOPS);
+    if(channels_len <= 0 || channels[0] == 0) {
+        flush_route_channels(route);
+        return;
+    }
+
+    if(route->has_channels) {
+        p = find_channels(route);
+        assert(p != NULL);
+        rc = *p;
+    } else {
+        if(channels_count >= channels_table_size) {
+            if(resize_channels_table(MAX(2 * channels_table_size, 16)) < 0) {
+                perror("malloc(channels)");
+                return;
+            }
+        }
+        rc = pool_alloc(sizeof(struct route_channels));
+        if(rc == NULL) {
+            perror("malloc(channels)");
+            return;
+        }
+        rc->route = route;
+        h = channels_hash(route, channels_table_size);
+        rc->next = channels_table[h];
+        channels_table[h] = rc;
+        channels_count++;
+        route->has_channels = 1;
+    }
+
+    memset(rc->channels, 0, DIVERSITY_HOPS);
+    memcpy(rc->channels, channels, channels_len);
+}
+
+/* Routes are kept on a hierarchical timing wheel, indexed by the time at
+   which they become old.  Level 0 has a bucket for every second, and a
+   bucket at level l spans 64^l seconds; its routes are moved down a level
+   when wheel_time enters its span.  A route whose deadline is pushed back
+   by an update stays where it is, and is rescheduled when it comes due. */
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 3
+#define WHEEL_SPAN ((time_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct babel_route *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static time_t wheel_time = 0;   /* the next second to process */
+
+/* The first second at which route_old is true. */
+static time_t
+route_deadline(struct babel_route *route)
+{
+    return route->time + route->hold_time * 7 / 8 + 1;
+}
+
+static void
+link_expiry_route(struct babel_route *route)
+{
+    struct babel_route **bucket;
+    time_t expiry;
+    int level = 0;
+
+    if(wheel_time == 0)
+        wheel_time = now.tv_sec;
+
+    expiry = MAX(route->expiry, wheel_time);
+    expiry = MIN(expiry, wheel_time + WHEEL_SPAN - 1);
+    while(level < WHEEL_LEVELS - 1 &&
+          expiry - wheel_time >= (time_t)1 << (WHEEL_BITS * (level + 1)))
+        level++;
+    bucket = &wheel[level][(expiry >> (WHEEL_BITS * level)) &
+                           (WHEEL_SIZE - 1)];
+
+    route->expiry_next = *bucket;
+    if(*bucket)
+        (*bucket)->expiry_pprev = &route->expiry_next;
+    route->expiry_pprev = bucket;
+    *bucket = route;
+}
+
+static void
+unlink_expiry_route(struct babel_route *route)
+{
+    if(route->expiry_pprev == NULL)
+        return;
+    *route->expiry_pprev = route->expiry_next;
+    if(route->expiry_next)
+        route->expiry_next->expiry_pprev = route->expiry_pprev;
+    route->expiry_next = NULL;
+    route->expiry_pprev = NULL;
+}
+
+/* Called when a route's time or hold time has changed. */
+static void
+reschedule_route(struct babel_route *route)
+{
+    time_t deadline = route_deadline(route);
+
+    if(deadline < route->expiry) {
+        unlink_expiry_route(route);
+        route->expiry = deadline;
+        link_expiry_route(route);
+    }
+}
+
+/* Returns an overestimate of the number of installed routes. */
+int
+installed_routes_estimate(void)
+{
+    return route_slots;
+}
+
 /* Insert a route into the table.  If successful, retains the route.
    On failure, caller must free the route. */
 static struct babel_route *
 insert_route(struct babel_route *route)
 {
-    int i, n;
+    struct trie_node *dst, *slot;
 
     assert(!route->installed);
 
-    i = find_route_slot(route->src->prefix, route->src->plen,
-                        route->src->src_prefix, route->src->src_plen, &n);
+    dst = trie_insert(&route_trie, route->src->prefix, route->src->plen);
+    if(dst == NULL)
+        return NULL;
 
-    if(i < 0) {
-        if(route_slots >= max_route_slots)
-            resize_route_table(max_route_slots < 1 ? 8 : 2 * max_route_slots);
-        if(route_slots >= max_route_slots)
-            return NULL;
-        route->next = NULL;
-        if(n < route_slots)
-            memmove(routes + n + 1, routes + n,
-                    (route_slots - n) * sizeof(struct babel_route*));
+    slot = trie_insert(&dst->sub, route->src->src_prefix, route->src->src_plen);
+    if(slot == NULL) {
+        trie_release(&route_trie, dst);
+        return NULL;
+    }
+
+    route->next = NULL;
+    if(slot->data == NULL) {
+        slot->data = route;
         route_slots++;
-        routes[n] = route;
     } else {
-        struct babel_route *r;
-        r = routes[i];
+        struct babel_route *r = slot->data;
         while(r->next)
             r = r->next;
         r->next = route;
-        route->next = NULL;
     }
 
+    link_neighbour_route(route);
+    route->expiry = route_deadline(route);
+    link_expiry_route(route);
     return route;
 }
 
 void
 flush_route(struct babel_route *route)
 {
-    int i;
+    struct trie_node *dst, *slot;
     struct source *src;
     unsigned oldmetric;
     int lost = 0;
@@ -235,36 +460,36 @@ flush_route(struct babel_route *route)
         lost = 1;
     }
 
-    i = find_route_slot(route->src->prefix, route->src->plen,
-                        route->src->src_prefix, route->src->src_plen, NULL);
-    assert(i >= 0 && i < route_slots);
+    dst = trie_find(route_trie, route->src->prefix, route->src->plen);
+    assert(dst != NULL);
+    slot = trie_find(dst->sub, route->src->src_prefix, route->src->src_plen);
+    assert(slot != NULL);
 
     local_notify_route(route, LOCAL_FLUSH);
 
-    if(route == routes[i]) {
-        routes[i] = route->next;
+    unlink_neighbour_route(route);
+    unlink_expiry_route(route);
+    flush_route_channels(route);
+    release_nexthop(route->neigh, route->nexthop);
+
+    if(route == slot->data) {
+        slot->data = route->next;
         route->next = NULL;
-        free(route);
+        pool_free(route, sizeof(struct babel_route));
 
-        if(routes[i] == NULL) {
-            if(i < route_slots - 1)
-                memmove(routes + i, routes + i + 1,
-                        (route_slots - i - 1) * sizeof(struct babel_route*));
-            routes[route_slots - 1] = NULL;
+        if(slot->data == NULL) {
+            trie_release(&dst->sub, slot);
+            if(dst->sub == NULL)
+                trie_release(&route_trie, dst);
             route_slots--;
         }
-
-        if(route_slots == 0)
-            resize_route_table(0);
-        else if(max_route_slots > 8 && route_slots < max_route_slots / 4)
-            resize_route_table(max_route_slots / 2);
     } else {
-        struct babel_route *r = routes[i];
+        struct babel_route *r = slot->data;
         while(r->next != route)
             r = r->next;
         r->next = route->next;
         route->next = NULL;
-        free(route);
+        pool_free(route, sizeof(struct babel_route));
     }
 
     if(lost)
@@ -276,18 +501,22 @@ flush_route(struct babel_route *route)
 void
 flush_all_routes()
 {
-    int i;
-
-    /* Start from the end, to avoid shifting the table. */
-    i = route_slots - 1;
-    while(i >= 0) {
-        while(i < route_slots) {
+    struct trie_node *dst = NULL, *slot, *next;
+
+    next = trie_next_sub(route_trie, &dst, NULL, 0);
+    while(next) {
+        slot = next;
+        next = trie_next_sub(route_trie, &dst, slot, 0);
+        while(1) {
+            struct babel_route *r = slot->data;
+            int last = r->next == NULL;
             /* Uninstall first, to avoid calling route_lost. */
-            if(routes[i]->installed)
-                uninstall_route(routes[i]);
-            flush_route(routes[i]);
+            if(r->installed)
+                uninstall_route(r);
+            flush_route(r);
+            if(last)
+                break;
         }
-        i--;
     }
 
     check_sources_released();
@@ -296,51 +525,31 @@ flush_all_routes()
 void
 flush_neighbour_routes(struct neighbour *neigh)
 {
-    int i;
-
-    i = 0;
-    while(i < route_slots) {
-        struct babel_route *r;
-        r = routes[i];
-        while(r) {
-            if(r->neigh == neigh) {
-                flush_route(r);
-                goto again;
-            }
-            r = r->next;
-        }
-        i++;
-    again:
-        ;
-    }
+    while(neigh->routes)
+        flush_route(neigh->routes);
 }
 
 void
 flush_interface_routes(struct interface *ifp, int v4only)
 {
-    int i;
+    struct neighbour *neigh;
 
-    i = 0;
-    while(i < route_slots) {
-        struct babel_route *r;
-        r = routes[i];
+    FOR_ALL_INTERFACE_NEIGHBOURS(ifp, neigh) {
+        struct babel_route *r = neigh->routes;
         while(r) {
-            if(r->neigh->ifp == ifp &&
-               (!v4only || v4mapped(r->nexthop))) {
+            struct babel_route *next = r->neigh_next;
+            if(!v4only || v4mapped(r->nexthop))
                 flush_route(r);
-                goto again;
-            }
-            r = r->next;
+            r = next;
         }
-        i++;
-    again:
-        ;
     }
 }
 
 struct route_stream {
     int installed;
-    int index;
+    int one_dst;
+    struct trie_node *dst;
+    struct trie_node *slot;
     struct babel_route *next;
 };
 
@@ -355,30 +564,57 @@ route_stream(int installed)
         return NULL;
 
     stream->installed = installed;
-    stream->index = installed ? 0 : -1;
+    stream->one_dst = 0;
+    stream->dst = NULL;
+    stream->slot = NULL;
     stream->next = NULL;
 
     return stream;
 }
 
+/* A stream of the installed routes to a given destination, whatever their
+   source prefix. */
+struct route_stream *
+route_stream_dst(const unsigned char *prefix, unsigned char plen)
+{
+    struct route_stream *stream;
+
+    stream = route_stream(1);
+    if(stream == NULL)
+        return NULL;
+
+    stream->one_dst = 1;
+    stream->dst = trie_find(route_trie, prefix, plen);
+
+    return stream;
+}
+
 struct babel_route *
 route_stream_next(struct route_stream *stream)
 {
     if(stream->installed) {
-        while(stream->index < route_slots && !routes[stream->index]->installed)
-            stream->index++;
-
-        if(stream->index < route_slots)
-            return routes[stream->index++];
-        else
-            return NULL;
+        if(stream->one_dst) {
+            if(stream->dst == NULL)
+                return NULL;
+            stream->slot = stream->slot ?
+                trie_next_counted(stream->slot) :
+                trie_first_counted(stream->dst->sub);
+            if(stream->slot == NULL)
+                stream->dst = NULL;
+        } else {
+            stream->slot =
+                trie_next_sub(route_trie, &stream->dst, stream->slot, 1);
+        }
+        assert(stream->slot == NULL || slot_installed(stream->slot));
+        return stream->slot ? stream->slot->data : NULL;
     } else {
         struct babel_route *next;
         if(!stream->next) {
-            stream->index++;
-            if(stream->index >= route_slots)
+            stream->slot =
+                trie_next_sub(route_trie, &stream->dst, stream->slot, 0);
+            if(stream->slot == NULL)
                 return NULL;
-            stream->next = routes[stream->index];
+            stream->next = stream->slot->data;
         }
         next = stream->next;
         stream->next = next->next;
@@ -400,56 +636,33 @@ find_min_iroute(const unsigned char *dst_prefix, unsigned char dst_plen,
                 const unsigned char *src_prefix, unsigned char src_plen,
                 int is_fixed_dst, int exclusive_min)
 {
-    enum prefix_status st;
     struct babel_route *result = NULL;
-    int i;
+    struct trie_node *dst, *slot;
 
+    /* The ancestors of a node are the prefixes that cover it, the most
+       specific one first.  Slots without an installed route are skipped. */
     if(is_fixed_dst) {
-        for(i = 0; i < route_slots; i++) {
-            if(!routes[i]->installed)
-                continue;
-            st = prefix_cmp(dst_prefix, dst_plen,
-                            routes[i]->src->prefix, routes[i]->src->plen);
-            if(st != PST_EQUALS)
-                continue;
-            st = prefix_cmp(src_prefix, src_plen,
-                            routes[i]->src->src_prefix,
-                            routes[i]->src->src_plen);
-            if(!(st & (exclusive_min ? PST_MORE_SPECIFIC :
-                       PST_MORE_SPECIFIC | PST_EQUALS)))
-                continue;
-            if(result &&
-               (prefix_cmp(result->src->src_prefix,
-                           result->src->src_plen,
-                           routes[i]->src->src_prefix,
-                           routes[i]->src->src_plen) == PST_MORE_SPECIFIC))
-                continue;
-
-            result = routes[i];
-        }
-
+        dst = trie_find(route_trie, dst_prefix, dst_plen);
+        if(dst == NULL)
+            return NULL;
+        slot = trie_match(dst->sub, src_prefix, src_plen);
+        if(slot && exclusive_min && slot->plen == src_plen)
+            slot = trie_parent(slot);
+        while(slot && !slot_installed(slot))
+            slot = trie_parent(slot);
+        if(slot)
+            result = slot->data;
     } else {
-        for(i = 0; i < route_slots; i++) {
-            if(!routes[i]->installed)
-                continue;
-            st = prefix_cmp(src_prefix, src_plen,
-                            routes[i]->src->src_prefix,
-                            routes[i]->src->src_plen);
-            if(st != PST_EQUALS)
-                continue;
-            st = prefix_cmp(dst_prefix, dst_plen,
-                            routes[i]->src->prefix, routes[i]->src->plen);
-            if(!(st & (exclusive_min ? PST_MORE_SPECIFIC :
-                       PST_MORE_SPECIFIC | PST_EQUALS)))
-                continue;
-            if(result &&
-               (prefix_cmp(result->src->prefix,
-                           result->src->plen,
-                           routes[i]->src->prefix,
-                           routes[i]->src->plen) == PST_MORE_SPECIFIC))
-                continue;
-
-            result = routes[i];
+        dst = trie_match(route_trie, dst_prefix, dst_plen);
+        if(dst && exclusive_min && dst->plen == dst_plen)
+            dst = trie_parent(dst);
+        while(dst) {
+            slot = trie_find(dst->sub, src_prefix, src_plen);
+            if(slot && slot_installed(slot)) {
+                result = slot->data;
+                break;
+            }
+            dst = trie_parent(dst);
         }
     }
 
@@ -476,25 +689,42 @@ metric_to_kernel(int metric)
 /* This is used to maintain the invariant that the installed route is at
    the head of the list. */
 static void
-move_installed_route(struct babel_route *route, int i)
+move_installed_route(struct babel_route *route, struct trie_node *slot)
 {
-    assert(i >= 0 && i < route_slots);
+    assert(slot != NULL);
     assert(route->installed);
 
-    if(route != routes[i]) {
-        struct babel_route *r = routes[i];
+    if(route != slot->data) {
+        struct babel_route *r = slot->data;
         while(r->next != route)
             r = r->next;
         r->next = route->next;
-        route->next = routes[i];
-        routes[i] = route;
+        route->next = slot->data;
+        slot->data = route;
     }
 }
 
+/* Count or uncount the installed route at the slot of route, in the
+   second-level trie and at its destination in the first-level one. */
+static void
+count_installed_route(struct babel_route *route, int delta)
+{
+    struct trie_node *dst, *slot;
+
+    dst = trie_find(route_trie, route->src->prefix, route->src->plen);
+    assert(dst != NULL);
+    slot = trie_find(dst->sub, route->src->src_prefix, route->src->src_plen);
+    assert(slot != NULL);
+    trie_count(slot, delta);
+    trie_count(dst, delta);
+}
+
 void
 install_route(struct babel_route *route)
 {
-    int i, rc;
+    struct trie_node *slot;
+    struct babel_route *head;
+    int rc;
 
     if(route->installed)
         return;
@@ -503,11 +733,12 @@ install_route(struct babel_route *route)
         fprintf(stderr, "WARNING: installing unfeasible route "
                 "(this shouldn't happen).");
 
-    i = find_route_slot(route->src->prefix, route->src->plen,
-                        route->src->src_prefix, route->src->src_plen, NULL);
-    assert(i >= 0 && i < route_slots);
+    slot = find_route_slot(route->src->prefix, route->src->plen,
+                           route->src->src_prefix, route->src->src_plen);
+    assert(slot != NULL);
 
-    if(routes[i] != route && routes[i]->installed) {
+    head = slot->data;
+    if(head != route && head->installed) {
         fprintf(stderr, "WARNING: attempting to install duplicate route "
                 "(this shouldn't happen).");
         return;
@@ -518,7 +749,8 @@ install_route(struct babel_route *route)
         return;
 
     route->installed = 1;
-    move_installed_route(route, i);
+    move_installed_route(route, slot);
+    count_installed_route(route, 1);
 
     local_notify_route(route, LOCAL_CHANGE);
 }
@@ -530,6 +762,7 @@ uninstall_route(struct babel_route *route)
         return;
 
     route->installed = 0;
+    count_installed_route(route, -1);
 
     kuninstall_route(route);
 
@@ -565,8 +798,7 @@ switch_routes(struct babel_route *old, struct babel_route *new)
     new->installed = 1;
     move_installed_route(new, find_route_slot(new->src->prefix, new->src->plen,
                                               new->src->src_prefix,
-                                              new->src->src_plen,
-                                              NULL));
+                                              new->src->src_plen));
     local_notify_route(old, LOCAL_CHANGE);
     local_notify_route(new, LOCAL_CHANGE);
 }
@@ -654,11 +886,12 @@ route_interferes(struct babel_route *route, struct interface *ifp)
         if(channels_interfere(ifp->channel, route->neigh->ifp->channel))
             return 1;
         if(diversity_kind == DIVERSITY_CHANNEL) {
+            const unsigned char *channels = route_channels(route);
             int i;
             for(i = 0; i < DIVERSITY_HOPS; i++) {
-                if(route->channels[i] == 0)
+                if(channels[i] == 0)
                     break;
-                if(channels_interfere(ifp->channel, route->channels[i]))
+                if(channels_interfere(ifp->channel, channels[i]))
                     return 1;
             }
         }
@@ -691,22 +924,32 @@ update_feasible(struct source *src,
 void
 change_smoothing_half_life(int half_life)
 {
-    if(half_life <= 0) {
-        smoothing_half_life = 0;
-        two_to_the_one_over_hl = 0;
-        return;
+    if(exp2_table[0] == 0) {
+        /* Repeated multiplication by 2^(-1/256), which is 4283353945 in
+           0.32 fixed point.  The product is split in two to fit in 64 bits,
+           and we keep 15 extra bits of precision. */
+        unsigned long long v = 1ULL << 47;
+        int i;
+        for(i = 0; i < 256; i++) {
+            exp2_table[i] = (v + (1ULL << 30)) >> 31;
+            v = ((v >> 16) * 4283353945ULL +
+                 (((v & 0xFFFF) * 4283353945ULL) >> 16)) >> 16;
+        }
     }
 
-    smoothing_half_life = half_life;
-    switch(smoothing_half_life) {
-    case 1: two_to_the_one_over_hl = 131072; break;
-    case 2: two_to_the_one_over_hl = 92682; break;
-    case 3: two_to_the_one_over_hl = 82570; break;
-    case 4: two_to_the_one_over_hl = 77935; break;
-    default:
-        /* 2^(1/x) is 1 + log(2)/x + O(1/x^2) at infinity. */
-        two_to_the_one_over_hl = 0x10000 + 45426 / half_life;
-    }
+    smoothing_half_life = MAX(half_life, 0);
+}
+
+/* Returns 2^(-secs/half_life) * 0x10000. */
+static unsigned int
+smoothing_decay(time_t secs)
+{
+    time_t halves = secs / smoothing_half_life;
+    int i = (secs % smoothing_half_life) * 256 / smoothing_half_life;
+
+    if(halves >= 17)
+        return 0;
+    return exp2_table[i] >> halves;
 }
 
 /* Update the smoothed metric, return the new value. */
@@ -722,22 +965,22 @@ route_smoothed_metric(struct babel_route *route)
         route->smoothed_metric = metric;
         route->smoothed_metric_time = now.tv_sec;
     } else {
-        int diff;
-        /* We randomise the computation, to minimise global synchronisation
-           and hence oscillations. */
-        while(route->smoothed_metric_time <= now.tv_sec - smoothing_half_life) {
-            diff = metric - route->smoothed_metric;
-            route->smoothed_metric += roughly(diff) / 2;
-            route->smoothed_metric_time += smoothing_half_life;
-        }
-        while(route->smoothed_metric_time < now.tv_sec) {
-            diff = metric - route->smoothed_metric;
-            route->smoothed_metric +=
-                roughly(diff) * (two_to_the_one_over_hl - 0x10000) / 0x10000;
-            route->smoothed_metric_time++;
+        int diff = metric - route->smoothed_metric;
+
+        if(route->smoothed_metric_time < now.tv_sec) {
+            unsigned decay =
+                smoothing_decay(now.tv_sec - route->smoothed_metric_time);
+            /* We randomise the computation, to minimise global
+               synchronisation and hence oscillations, but never move
+               away from the metric. */
+            int left = roughly((int)((long long)diff * decay / 0x10000));
+            if(diff > 0 ? left > diff : left < diff)
+                left = diff;
+            diff = left;
+            route->smoothed_metric = metric - diff;
+            route->smoothed_metric_time = now.tv_sec;
         }
 
-        diff = metric - route->smoothed_metric;
         if(diff > -4 && diff < 4)
             route->smoothed_metric = metric;
     }
@@ -771,12 +1014,13 @@ find_best_route(const unsigned char *prefix, unsigned char plen,
                 int feasible, struct neighbour *exclude)
 {
     struct babel_route *route, *r;
-    int i = find_route_slot(prefix, plen, src_prefix, src_plen, NULL);
+    struct trie_node *slot =
+        find_route_slot(prefix, plen, src_prefix, src_plen);
 
-    if(i < 0)
+    if(slot == NULL)
         return NULL;
 
-    route = routes[i];
+    route = slot->data;
     while(route && !route_acceptable(route, feasible, exclude))
         route = route->next;
 
@@ -830,16 +1074,10 @@ update_neighbour_metric(struct neighbour *neigh, int changed)
 {
 
     if(changed) {
-        int i;
+        struct babel_route *r;
 
-        for(i = 0; i < route_slots; i++) {
-            struct babel_route *r = routes[i];
-            while(r) {
-                if(r->neigh == neigh)
-                    update_route_metric(r);
-                r = r->next;
-            }
-        }
+        for(r = neigh->routes; r; r = r->neigh_next)
+            update_route_metric(r);
     }
 
     local_notify_neighbour(neigh, LOCAL_CHANGE);
@@ -848,15 +1086,12 @@ update_neighbour_metric(struct neighbour *neigh, int changed)
 void
 update_interface_metric(struct interface *ifp)
 {
-    int i;
+    struct neighbour *neigh;
+    struct babel_route *r;
 
-    for(i = 0; i < route_slots; i++) {
-        struct babel_route *r = routes[i];
-        while(r) {
-            if(r->neigh->ifp == ifp)
-                update_route_metric(r);
-            r = r->next;
-        }
+    FOR_ALL_INTERFACE_NEIGHBOURS(ifp, neigh) {
+        for(r = neigh->routes; r; r = r->neigh_next)
+            update_route_metric(r);
     }
 }
 
@@ -910,15 +1145,15 @@ update_route(const unsigned char *id,
     if(allow_generic_redistribution) {
         struct route_stream *stream = NULL;
         struct babel_route *rt = NULL;
-        stream = route_stream(1);
+        stream = route_stream_dst(prefix, plen);
+        if(stream == NULL)
+            return NULL;
         if(src_plen == 0) {
             /* reject route if a specific one exists for that destination */
             while(1) {
                 rt = route_stream_next(stream);
                 if(rt == NULL) break;
-                if(rt->src->src_plen != 0 &&
-                   prefix_cmp(prefix, plen, rt->src->prefix, rt->src->plen) ==
-                   PST_EQUALS) {
+                if(rt->src->src_plen != 0) {
                     route_stream_done(stream);
                     return NULL;
                 }
@@ -928,9 +1163,7 @@ update_route(const unsigned char *id,
             while(1) {
                 rt = route_stream_next(stream);
                 if(rt == NULL) break;
-                if(rt->src->src_plen == 0 &&
-                   prefix_cmp(prefix, plen, rt->src->prefix, rt->src->plen) ==
-                   PST_EQUALS) {
+                if(rt->src->src_plen == 0) {
                     uninstall_route(rt);
                     break;
                 }
@@ -983,14 +1216,12 @@ update_route(const unsigned char *id,
             route->time = now.tv_sec;
         route->seqno = seqno;
 
-        memset(&route->channels, 0, sizeof(route->channels));
-        if(channels_len > 0)
-            memcpy(&route->channels, channels,
-                   MIN(channels_len, DIVERSITY_HOPS));
+        set_route_channels(route, channels, channels_len);
 
         change_route_metric(route,
                             refmetric, neighbour_cost(neigh), add_metric);
         route->hold_time = hold_time;
+        reschedule_route(route);
 
         route_changed(route, oldsrc, oldmetric);
         if(lost)
@@ -1012,7 +1243,7 @@ update_route(const unsigned char *id,
                 return NULL;
         }
 
-        route = malloc(sizeof(struct babel_route));
+        route = pool_alloc(sizeof(struct babel_route));
         if(route == NULL) {
             perror("malloc(route)");
             return NULL;
@@ -1024,23 +1255,30 @@ update_route(const unsigned char *id,
         route->add_metric = add_metric;
         route->seqno = seqno;
         route->neigh = neigh;
-        memcpy(route->nexthop, nexthop, 16);
+        route->nexthop = retain_nexthop(neigh, nexthop);
+        if(route->nexthop == NULL) {
+            release_source(route->src);
+            pool_free(route, sizeof(struct babel_route));
+            return NULL;
+        }
         route->time = now.tv_sec;
         route->hold_time = hold_time;
         route->smoothed_metric = MAX(route_metric(route), INFINITY / 2);
         route->smoothed_metric_time = now.tv_sec;
         route->installed = 0;
-        memset(&route->channels, 0, sizeof(route->channels));
-        if(channels_len > 0)
-            memcpy(&route->channels, channels,
-                   MIN(channels_len, DIVERSITY_HOPS));
+        route->has_channels = 0;
         route->next = NULL;
+        route->expiry_next = NULL;
+        route->expiry_pprev = NULL;
         new_route = insert_route(route);
         if(new_route == NULL) {
             fprintf(stderr, "Couldn't insert route.\n");
-            free(route);
+            release_nexthop(neigh, route->nexthop);
+            release_source(route->src);
+            pool_free(route, sizeof(struct babel_route));
             return NULL;
         }
+        set_route_channels(route, channels, channels_len);
         local_notify_route(route, LOCAL_ADD);
         consider_route(route);
     }
@@ -1127,22 +1365,15 @@ consider_route(struct babel_route *route)
 void
 retract_neighbour_routes(struct neighbour *neigh)
 {
-    int i;
+    struct babel_route *r;
 
-    for(i = 0; i < route_slots; i++) {
-        struct babel_route *r = routes[i];
-        while(r) {
-            if(r->neigh == neigh) {
-                if(r->refmetric != INFINITY) {
-                    unsigned short oldmetric = route_metric(r);
-                    retract_route(r);
-                    if(oldmetric != INFINITY)
-                        route_changed(r, r->src, oldmetric);
-                }
-            }
-            r = r->next;
+    for(r = neigh->routes; r; r = r->neigh_next) {
+        if(r->refmetric != INFINITY) {
+            unsigned short oldmetric = route_metric(r);
+            retract_route(r);
+            if(oldmetric != INFINITY)
+                route_changed(r, r->src, oldmetric);
         }
-        i++;
     }
 }
 
@@ -1153,6 +1384,7 @@ send_triggered_update(struct babel_route *route, struct source *oldsrc,
     unsigned newmetric, diff;
     /* 1 means send speedily, 2 means resend */
     int urgent;
+    int requested = 0;
 
     if(!route->installed)
         return;
@@ -1170,9 +1402,11 @@ send_triggered_update(struct babel_route *route, struct source *oldsrc,
         urgent = 1;
     else if(unsatisfied_request(route->src->prefix, route->src->plen,
                                 route->src->src_prefix, route->src->src_plen,
-                                route->seqno, route->src->id))
+                                route->seqno, route->src->id)) {
         /* Make sure that requests are satisfied speedily */
         urgent = 1;
+        requested = 1;
+    }
     else if(oldmetric >= INFINITY && newmetric < INFINITY)
         /* New route */
         urgent = 0;
@@ -1186,10 +1420,15 @@ send_triggered_update(struct babel_route *route, struct source *oldsrc,
     else
         urgent = 0;
 
+    /* A forwarded request is answered on the interfaces of the
+       neighbours that asked for it. */
     if(urgent >= 2)
         send_update_resend(NULL, route->src->prefix, route->src->plen,
                            route->src->src_prefix, route->src->src_plen);
-    else
+    else if(!requested ||
+            send_update_requesters(route->src->prefix, route->src->plen,
+                                   route->src->src_prefix,
+                                   route->src->src_plen) == 0)
         send_update(NULL, urgent, route->src->prefix, route->src->plen,
                     route->src->src_prefix, route->src->src_plen);
 
@@ -1260,39 +1499,111 @@ route_lost(struct source *src, unsigned oldmetric)
     }
 }
 
-/* This is called periodically to flush old routes.  It will also send
-   requests for routes that are about to expire. */
-void
-expire_routes(void)
+/* Move all the routes of a bucket to the levels below. */
+static void
+cascade_routes(struct babel_route **bucket)
 {
     struct babel_route *r;
-    int i;
 
-    debugf("Expiring old routes.\n");
+    while((r = *bucket) != NULL) {
+        unlink_expiry_route(r);
+        link_expiry_route(r);
+    }
+}
 
-    i = 0;
-    while(i < route_slots) {
-        r = routes[i];
-        while(r) {
-            /* Protect against clock being stepped. */
-            if(r->time > now.tv_sec || route_old(r)) {
-                flush_route(r);
-                goto again;
+/* Called when we've lost track of time: relink every route relative to
+   the current time. */
+static void
+reset_expiry_wheel(void)
+{
+    struct babel_route *routes = NULL, *r;
+    int i, j;
+
+    for(i = 0; i < WHEEL_LEVELS; i++) {
+        for(j = 0; j < WHEEL_SIZE; j++) {
+            while((r = wheel[i][j]) != NULL) {
+                unlink_expiry_route(r);
+                r->expiry_next = routes;
+                routes = r;
             }
+        }
+    }
 
-            update_route_metric(r);
+    wheel_time = now.tv_sec;
+    while(routes) {
+        r = routes;
+        routes = r->expiry_next;
+        /* Protect against clock being stepped. */
+        if(r->time > now.tv_sec)
+            r->expiry = now.tv_sec;
+        link_expiry_route(r);
+    }
+}
 
-            if(r->installed && r->refmetric < INFINITY) {
-                if(route_old(r))
-                    /* Route about to expire, send a request. */
-                    send_unicast_request(r->neigh,
-                                         r->src->prefix, r->src->plen,
-                                         r->src->src_prefix, r->src->src_plen);
-            }
-            r = r->next;
+static void
+expire_route(struct babel_route *route)
+{
+    /* Protect against clock being stepped. */
+    if(route->time > now.tv_sec || route_old(route)) {
+        flush_route(route);
+        return;
+    }
+
+    update_route_metric(route);
+    route->expiry = route_deadline(route);
+    link_expiry_route(route);
+}
+
+/* This is called whenever a route might have become old, and flushes the
+   routes that are due. */
+void
+expire_routes(void)
+{
+    struct babel_route **bucket;
+    int level;
+
+    if(wheel_time == 0)
+        return;
+
+    if(wheel_time > now.tv_sec + 1 || now.tv_sec - wheel_time >= WHEEL_SPAN)
+        reset_expiry_wheel();
+
+    while(wheel_time <= now.tv_sec) {
+        for(level = 1; level < WHEEL_LEVELS; level++) {
+            if((wheel_time & (((time_t)1 << (WHEEL_BITS * level)) - 1)) != 0)
+                break;
+            cascade_routes(&wheel[level][(wheel_time >>
+                                          (WHEEL_BITS * level)) &
+                                         (WHEEL_SIZE - 1)]);
         }
-        i++;
-    again:
-        ;
+
+        bucket = &wheel[0][wheel_time & (WHEEL_SIZE - 1)];
+        while(*bucket) {
+            struct babel_route *r = *bucket;
+            unlink_expiry_route(r);
+            expire_route(r);
+        }
+        wheel_time++;
     }
 }
+
+/* The time at which expire_routes should next be called. */
+time_t
+route_expiry_time(void)
+{
+    time_t t;
+
+    if(wheel_time == 0)
+        return now.tv_sec + WHEEL_SIZE;
+    if(wheel_time > now.tv_sec + 1)
+        return now.tv_sec;
+
+    /* Stop at the next boundary, where the upper levels are cascaded. */
+    t = wheel_time;
+    do {
+        if(wheel[0][t & (WHEEL_SIZE - 1)])
+            return t;
+        t++;
+    } while((t & (WHEEL_SIZE - 1)) != 0);
+    return t;
+}
@@ -27,26 +27,35 @@ THE SOFTWARE.
 
 #define DIVERSITY_HOPS 8
 
+/* There may be millions of these, so keep them small.  The fields used by
+   route selection come first, and fit in 64 bytes on LP64 systems. */
+
 struct babel_route {
     struct source *src;
+    struct neighbour *neigh;
+    struct babel_route *next;
     unsigned short refmetric;
     unsigned short cost;
     unsigned short add_metric;
     unsigned short seqno;
-    struct neighbour *neigh;
-    unsigned char nexthop[16];
-    time_t time;
-    unsigned short hold_time;    /* in seconds */
     unsigned short smoothed_metric; /* for route selection */
-    time_t smoothed_metric_time;
-    short installed;
-    unsigned char channels[DIVERSITY_HOPS];
-    struct babel_route *next;
+    unsigned short hold_time;    /* in seconds */
+    /* Times are in seconds; 32 bits are enough. */
+    unsigned int time;
+    unsigned int smoothed_metric_time;
+    unsigned int expiry;         /* position on the expiry wheel */
+    unsigned char installed;
+    unsigned char has_channels;  /* see route_channels */
+    /* Either neigh->address, or shared with the other routes through the
+       same neighbour. */
+    const unsigned char *nexthop;
+    /* List of the routes through the same neighbour. */
+    struct babel_route *neigh_next, *neigh_prev;
+    struct babel_route *expiry_next, **expiry_pprev;
 };
 
 struct route_stream;
 
-extern struct babel_route **routes;
 extern int kernel_metric, allow_duplicates, reflect_kernel_metric;
 extern int diversity_kind, diversity_factor;
 extern int keep_unfeasible;
@@ -85,6 +94,8 @@ void flush_all_routes(void);
 void flush_neighbour_routes(struct neighbour *neigh);
 void flush_interface_routes(struct interface *ifp, int v4only);
 struct route_stream *route_stream(int installed);
+struct route_stream *route_stream_dst(const unsigned char *prefix,
+                                      unsigned char plen);
 struct babel_route *route_stream_next(struct route_stream *stream);
 void route_stream_done(struct route_stream *stream);
 int metric_to_kernel(int metric);
@@ -93,6 +104,7 @@ void uninstall_route(struct babel_route *route);
 int route_feasible(struct babel_route *route);
 int route_old(struct babel_route *route);
 int route_expired(struct babel_route *route);
+const unsigned char *route_channels(struct babel_route *route);
 int route_interferes(struct babel_route *route, struct interface *ifp);
 int update_feasible(struct source *src,
                     unsigned short seqno, unsigned short refmetric);
@@ -127,3 +139,4 @@ void route_changed(struct babel_route *route,
                    struct source *oldsrc, unsigned short oldmetric);
 void route_lost(struct source *src, unsigned oldmetric);
 void expire_routes(void);
+time_t route_expiry_time(void);
@@ -31,8 +31,119 @@ THE SOFTWARE.
 #include "source.h"
 #include "interface.h"
 #include "route.h"
+#include "pool.h"
 
-struct source *srcs = NULL;
+/* The sources are kept in an open-addressing hash table with linear
+   probing.  The table is at most half full, and is only shrunk by
+   expire_sources, so that flush_source may be called while walking it. */
+
+static struct source **sources = NULL;
+static int source_slots = 0, numsources = 0;
+
+#define MIN_SOURCE_SLOTS 64
+
+/* The sources with a null route_count are also kept in a list, in the
+   order in which they became unused or were last updated.  A source's
+   time is never later than the moment it was queued, so stopping at the
+   first source that hasn't expired delays the others by at most
+   SOURCE_GC_TIME after they became unused. */
+
+static struct source *unused_head = NULL, *unused_tail = NULL;
+
+/* The latest time given to any source, used to detect the clock stepping
+   back without scanning the table. */
+static time_t latest_source_time = 0;
+
+#define SOURCE_GC_BATCH 1024
+
+static void
+link_unused_source(struct source *src)
+{
+    src->unused_next = NULL;
+    src->unused_prev = unused_tail;
+    if(unused_tail)
+        unused_tail->unused_next = src;
+    else
+        unused_head = src;
+    unused_tail = src;
+}
+
+static void
+unlink_unused_source(struct source *src)
+{
+    if(src->unused_prev)
+        src->unused_prev->unused_next = src->unused_next;
+    else
+        unused_head = src->unused_next;
+    if(src->unused_next)
+        src->unused_next->unused_prev = src->unused_prev;
+    else
+        unused_tail = src->unused_prev;
+    src->unused_next = src->unused_prev = NULL;
+}
+
+static unsigned long long
+hash_step(unsigned long long h, const unsigned char *p)
+{
+    unsigned long long w;
+
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+static int
+source_hash(const unsigned char *id,
+            const unsigned char *prefix, unsigned char plen,
+            const unsigned char *src_prefix, unsigned char src_plen)
+{
+    unsigned long long h = plen | (src_plen << 8);
+
+    h = hash_step(h, id);
+    h = hash_step(h, prefix);
+    h = hash_step(h, prefix + 8);
+    h = hash_step(h, src_prefix);
+    h = hash_step(h, src_prefix + 8);
+    return (h >> 32) & (source_slots - 1);
+}
+
+static int
+source_match(const struct source *src, const unsigned char *id,
+             const unsigned char *prefix, unsigned char plen,
+             const unsigned char *src_prefix, unsigned char src_plen)
+{
+    return src->plen == plen && src->src_plen == src_plen &&
+        memcmp(src->id, id, 8) == 0 &&
+        memcmp(src->prefix, prefix, 16) == 0 &&
+        memcmp(src->src_prefix, src_prefix, 16) == 0;
+}
+
+static int
+resize_sources(int slots)
+{
+    struct source **old = sources;
+    int old_slots = source_slots, i, h;
+
+    sources = calloc(slots, sizeof(struct source*));
+    if(sources == NULL) {
+        sources = old;
+        return -1;
+    }
+    source_slots = slots;
+
+    for(i = 0; i < old_slots; i++) {
+        struct source *src = old[i];
+        if(src == NULL)
+            continue;
+        h = source_hash(src->id, src->prefix, src->plen,
+                        src->src_prefix, src->src_plen);
+        while(sources[h])
+            h = (h + 1) & (source_slots - 1);
+        sources[h] = src;
+    }
+    free(old);
+    return 1;
+}
 
 struct source*
 find_source(const unsigned char *id,
@@ -41,28 +152,29 @@ find_source(const unsigned char *id,
             int create, unsigned short seqno)
 {
     struct source *src;
+    int h;
 
-    for(src = srcs; src; src = src->next) {
-        /* This should really be a hash table.  For now, check the
-           last byte first. */
-        if(src->id[7] != id[7])
-            continue;
-        if(memcmp(src->id, id, 8) != 0)
-            continue;
-        if(src->plen != plen)
-            continue;
-        if(src->src_plen != src_plen)
-            continue;
-        if(memcmp(src->prefix, prefix, 16) != 0)
-            continue;
-        if(memcmp(src->src_prefix, src_prefix, 16) == 0)
-            return src;
+    if(source_slots > 0) {
+        h = source_hash(id, prefix, plen, src_prefix, src_plen);
+        while((src = sources[h]) != NULL) {
+            if(source_match(src, id, prefix, plen, src_prefix, src_plen))
+                return src;
+            h = (h + 1) & (source_slots - 1);
+        }
     }
 
     if(!create)
         return NULL;
 
-    src = malloc(sizeof(struct source));
+    if(2 * (numsources + 1) > source_slots) {
+        int rc = resize_sources(MAX(2 * source_slots, MIN_SOURCE_SLOTS));
+        if(rc < 0 && numsources + 1 >= source_slots) {
+            perror("malloc(sources)");
+            return NULL;
+        }
+    }
+
+    src = pool_alloc(sizeof(struct source));
     if(src == NULL) {
         perror("malloc(source)");
         return NULL;
@@ -76,9 +188,15 @@ find_source(const unsigned char *id,
     src->seqno = seqno;
     src->metric = INFINITY;
     src->time = now.tv_sec;
+    latest_source_time = MAX(latest_source_time, now.tv_sec);
     src->route_count = 0;
-    src->next = srcs;
-    srcs = src;
+    link_unused_source(src);
+
+    h = source_hash(id, prefix, plen, src_prefix, src_plen);
+    while(sources[h])
+        h = (h + 1) & (source_slots - 1);
+    sources[h] = src;
+    numsources++;
     return src;
 }
 
@@ -86,6 +204,8 @@ struct source *
 retain_source(struct source *src)
 {
     assert(src->route_count < 0xffff);
+    if(src->route_count == 0)
+        unlink_unused_source(src);
     src->route_count++;
     return src;
 }
@@ -95,25 +215,52 @@ release_source(struct source *src)
 {
     assert(src->route_count > 0);
     src->route_count--;
+    if(src->route_count == 0)
+        link_unused_source(src);
 }
 
 int
 flush_source(struct source *src)
 {
+    int i, j, h;
+
     if(src->route_count > 0)
         /* The source is in use by a route. */
         return 0;
 
-    if(srcs == src) {
-        srcs = src->next;
-    } else {
-        struct source *previous = srcs;
-        while(previous->next != src)
-            previous = previous->next;
-        previous->next = src->next;
+    unlink_unused_source(src);
+
+    i = source_hash(src->id, src->prefix, src->plen,
+                    src->src_prefix, src->src_plen);
+    while(sources[i] != src) {
+        assert(sources[i] != NULL);
+        i = (i + 1) & (source_slots - 1);
     }
 
-    free(src);
+    /* Move back the following entries that would no longer be reachable
+       across the hole. */
+    j = i;
+    while(1) {
+        sources[i] = NULL;
+        while(1) {
+            j = (j + 1) & (source_slots - 1);
+            if(sources[j] == NULL)
+                goto done;
+            h = source_hash(sources[j]->id,
+                            sources[j]->prefix, sources[j]->plen,
+                            sources[j]->src_prefix, sources[j]->src_plen);
+            /* Can the entry at j stay where it is? */
+            if(i <= j ? (i < h && h <= j) : (i < h || h <= j))
+                continue;
+            break;
+        }
+        sources[i] = sources[j];
+        i = j;
+    }
+
+ done:
+    numsources--;
+    pool_free(src, sizeof(struct source));
     return 1;
 }
 
@@ -135,35 +282,51 @@ update_source(struct source *src,
         src->metric = metric;
     }
     src->time = now.tv_sec;
+    latest_source_time = MAX(latest_source_time, now.tv_sec);
+    if(src->route_count == 0 && src != unused_tail) {
+        unlink_unused_source(src);
+        link_unused_source(src);
+    }
 }
 
-void
+/* Flush a batch of unused sources that have expired.  Returns 1 if there
+   are more to flush, in which case this should be called again soon. */
+int
 expire_sources()
 {
-    struct source *src;
+    int i, n = 0;
 
-    src = srcs;
-    while(src) {
-        if(src->time > now.tv_sec)
-            /* clock stepped */
-            src->time = now.tv_sec;
-        if(src->time < now.tv_sec - SOURCE_GC_TIME) {
-            struct source *old = src;
-            src = src->next;
-            flush_source(old);
-            continue;
+    if(latest_source_time > now.tv_sec) {
+        /* clock stepped */
+        for(i = 0; i < source_slots; i++) {
+            if(sources[i])
+                sources[i]->time = MIN(sources[i]->time, now.tv_sec);
         }
-        src = src->next;
+        latest_source_time = now.tv_sec;
     }
+
+    while(unused_head &&
+          unused_head->time < now.tv_sec - SOURCE_GC_TIME) {
+        if(n >= SOURCE_GC_BATCH)
+            return 1;
+        flush_source(unused_head);
+        n++;
+    }
+
+    if(source_slots > MIN_SOURCE_SLOTS && 8 * numsources < source_slots)
+        resize_sources(source_slots / 2);
+    return 0;
 }
 
 void
 check_sources_released(void)
 {
     struct source *src;
+    int i;
 
-    for(src = srcs; src; src = src->next) {
-        if(src->route_count != 0)
+    for(i = 0; i < source_slots; i++) {
+        src = sources[i];
+        if(src != NULL && src->route_count != 0)
             fprintf(stderr, "Warning: source %s %s has refcount %d.\n",
                     format_eui64(src->id),
                     format_prefix(src->prefix, src->plen),
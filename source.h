@@ -23,7 +23,6 @@ THE SOFTWARE.
 #define SOURCE_GC_TIME 200
 
 struct source {
-    struct source *next;
     unsigned char id[8];
     unsigned char prefix[16];
     unsigned char plen;
@@ -33,6 +32,8 @@ struct source {
     unsigned short metric;
     unsigned short route_count;
     time_t time;
+    /* Sources not used by any route, oldest first; see expire_sources. */
+    struct source *unused_next, *unused_prev;
 };
 
 struct source *find_source(const unsigned char *id,
@@ -46,5 +47,5 @@ void release_source(struct source *src);
 int flush_source(struct source *src);
 void update_source(struct source *src,
                    unsigned short seqno, unsigned short metric);
-void expire_sources(void);
+int expire_sources(void);
 void check_sources_released(void);
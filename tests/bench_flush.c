@@ -0,0 +1,254 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Cost of ordering the buffered updates in flushupdates: resolving each
+   update once and sorting on a precomputed key, compared with the code
+   that it replaced, which looked up the installed route before sorting,
+   compared the updates field by field, and looked up the route and the
+   xroute again after sorting.  Both must give the same order. */
+
+#include "../message.c"
+#include "../pool.h"
+
+#include "bench.h"
+
+#define ROUTERS 64
+#define ROUTES 100000
+#define ROUNDS 5
+
+struct babel_route *bench_insert_route(struct babel_route *route);
+
+/* struct buffered_update as it was, with the router-id. */
+
+struct old_update {
+    unsigned char id[8];
+    unsigned char prefix[16];
+    unsigned char src_prefix[16];
+    unsigned char plen;
+    unsigned char src_plen;
+    unsigned char pad[2];
+};
+
+static int
+compare_old_updates(const void *av, const void *bv)
+{
+    const struct old_update *a = av, *b = bv;
+    int rc, v4a, v4b, ma, mb;
+
+    rc = memcmp(a->id, b->id, 8);
+    if(rc != 0)
+        return rc;
+
+    v4a = (a->plen >= 96 && v4mapped(a->prefix));
+    v4b = (b->plen >= 96 && v4mapped(b->prefix));
+
+    if(v4a > v4b)
+        return 1;
+    else if(v4a < v4b)
+        return -1;
+
+    ma = (!v4a && a->plen == 128 && memcmp(a->prefix + 8, a->id, 8) == 0);
+    mb = (!v4b && b->plen == 128 && memcmp(b->prefix + 8, b->id, 8) == 0);
+
+    if(ma > mb)
+        return -1;
+    else if(mb > ma)
+        return 1;
+
+    if(a->plen < b->plen)
+        return 1;
+    else if(a->plen > b->plen)
+        return -1;
+
+    rc = memcmp(a->prefix, b->prefix, 16);
+    if(rc != 0)
+        return rc;
+    if(a->src_plen < b->src_plen)
+        return -1;
+    else if(a->src_plen > b->src_plen)
+        return 1;
+    return memcmp(a->src_prefix, b->src_prefix, 16);
+}
+
+static void *volatile sink;
+
+static void
+old_order(struct old_update *u, int n)
+{
+    struct babel_route *route;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        route = find_installed_route(u[i].prefix, u[i].plen,
+                                     u[i].src_prefix, u[i].src_plen);
+        if(route)
+            memcpy(u[i].id, route->src->id, 8);
+        else
+            memcpy(u[i].id, myid, 8);
+    }
+    qsort(u, n, sizeof(struct old_update), compare_old_updates);
+    for(i = 0; i < n; i++) {
+        sink = find_xroute(u[i].prefix, u[i].plen,
+                           u[i].src_prefix, u[i].src_plen);
+        sink = find_installed_route(u[i].prefix, u[i].plen,
+                                    u[i].src_prefix, u[i].src_plen);
+    }
+}
+
+static void
+new_order(struct update_entry *entries, struct buffered_update *b, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++)
+        resolve_update(&entries[i], &b[i]);
+    qsort(entries, n, sizeof(struct update_entry), compare_update_entries);
+}
+
+/* A quarter of the prefixes are IPv4, and each router announces its own
+   /128, which the sort puts first. */
+static void
+make_prefix(unsigned char *prefix, unsigned char *plen_r,
+            const unsigned char *ids, int i)
+{
+    memset(prefix, 0, 16);
+    if(i < ROUTERS) {
+        memcpy(prefix, "\xfd\x00", 2);
+        memcpy(prefix + 8, ids + 8 * i, 8);
+        *plen_r = 128;
+    } else if(i % 4 == 0) {
+        memcpy(prefix + 10, "\xff\xff", 2);
+        DO_HTONL(prefix + 12, (10 << 24) | i);
+        *plen_r = 128;
+    } else {
+        memcpy(prefix, "\x20\x01\x0d\xb8", 4);
+        DO_HTONL(prefix + 4, i);
+        *plen_r = 64;
+    }
+}
+
+int
+main(void)
+{
+    static const int sizes[] = {1000, 10000, 100000};
+    static unsigned char ids[ROUTERS * 8];
+    struct neighbour neigh;
+    unsigned char prefix[16], plen;
+    int s, i, r;
+    double t0, old_time, new_time;
+
+    srandom(42);
+    bench_random_bytes(myid, 8);
+    bench_random_bytes(ids, sizeof(ids));
+    memset(&neigh, 0, sizeof(neigh));
+
+    for(i = 0; i < ROUTES; i++) {
+        struct babel_route *route;
+        make_prefix(prefix, &plen, ids, i);
+        route = pool_alloc(sizeof(struct babel_route));
+        if(route == NULL) {
+            perror("malloc(route)");
+            return 1;
+        }
+        memset(route, 0, sizeof(struct babel_route));
+        route->src = find_source(ids + 8 * (i % ROUTERS), prefix, plen,
+                                 zeroes, 0, 1, 0);
+        if(route->src == NULL)
+            return 1;
+        retain_source(route->src);
+        route->neigh = &neigh;
+        route->nexthop = neigh.address;
+        route->hold_time = 60;
+        if(bench_insert_route(route) == NULL)
+            return 1;
+        route->installed = 1;
+    }
+
+    printf("updates  old (us)  new (us)\n");
+
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int n = sizes[s];
+        struct buffered_update *b, *b0;
+        struct old_update *u;
+        struct update_entry *entries;
+
+        b0 = malloc(n * sizeof(struct buffered_update));
+        b = malloc(n * sizeof(struct buffered_update));
+        u = malloc(n * sizeof(struct old_update));
+        entries = malloc(n * sizeof(struct update_entry));
+        if(b0 == NULL || b == NULL || u == NULL || entries == NULL) {
+            perror("malloc");
+            return 1;
+        }
+
+        /* Random routes, some of them scheduled twice, and a few
+           retractions of prefixes that are no longer in the table. */
+        for(i = 0; i < n; i++) {
+            memset(&b0[i], 0, sizeof(struct buffered_update));
+            if(i % 10 == 1)
+                b0[i] = b0[random() % i];
+            else if(i % 50 == 2)
+                make_prefix(b0[i].prefix, &b0[i].plen, ids,
+                            ROUTES + random() % ROUTES);
+            else
+                make_prefix(b0[i].prefix, &b0[i].plen, ids,
+                            random() % ROUTES);
+        }
+
+        old_time = new_time = 0;
+        for(r = 0; r < ROUNDS; r++) {
+            for(i = 0; i < n; i++) {
+                memset(u[i].id, 0, 8);
+                memcpy(u[i].prefix, b0[i].prefix, 16);
+                memcpy(u[i].src_prefix, b0[i].src_prefix, 16);
+                u[i].plen = b0[i].plen;
+                u[i].src_plen = b0[i].src_plen;
+            }
+            t0 = bench_time();
+            old_order(u, n);
+            old_time += bench_time() - t0;
+
+            memcpy(b, b0, n * sizeof(struct buffered_update));
+            t0 = bench_time();
+            new_order(entries, b, n);
+            new_time += bench_time() - t0;
+        }
+
+        for(i = 0; i < n; i++) {
+            struct buffered_update *bu = entries[i].b;
+            if(bu->plen != u[i].plen ||
+               memcmp(bu->prefix, u[i].prefix, 16) != 0) {
+                printf("FAIL: orders differ at %d\n", i);
+                return 1;
+            }
+        }
+
+        printf("%7d  %8.0f  %8.0f\n",
+               n, old_time / ROUNDS * 1E6, new_time / ROUNDS * 1E6);
+
+        free(entries);
+        free(u);
+        free(b);
+        free(b0);
+    }
+    return 0;
+}
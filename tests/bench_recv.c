@@ -0,0 +1,174 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Check that babel_recv_multi returns the datagrams queued on a socket in
+   order, with their lengths and source addresses, and time it for several
+   batch sizes against one babel_recv per datagram.  The datagrams are sent
+   over the loopback before the timer is started. */
+
+#define BABEL_RECV_BATCH 64
+#include "../net.c"
+
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define PACKETS 64
+#define ROUNDS 2000
+#define MAXLEN 1500
+
+static unsigned char buf[MAXLEN * BABEL_RECV_BATCH];
+static struct sockaddr_in6 sins[BABEL_RECV_BATCH];
+static int lens[BABEL_RECV_BATCH];
+
+static int
+packet_len(int seqno)
+{
+    return 100 + (seqno * 37) % 1300;
+}
+
+static int
+send_packets(int s, struct sockaddr_in6 *to, int seqno)
+{
+    static unsigned char packet[MAXLEN];
+    int i, rc;
+
+    for(i = 0; i < PACKETS; i++) {
+        DO_HTONL(packet, seqno + i);
+        memset(packet + 4, (seqno + i) & 0xFF, packet_len(seqno + i) - 4);
+        rc = sendto(s, packet, packet_len(seqno + i), 0,
+                    (struct sockaddr*)to, sizeof(*to));
+        if(rc < 0) {
+            perror("sendto");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+check_packet(const unsigned char *packet, int len,
+             const struct sockaddr_in6 *from, int port, int seqno)
+{
+    unsigned int n;
+
+    DO_NTOHL(n, packet);
+    if(n != seqno || len != packet_len(seqno) ||
+       packet[len - 1] != (seqno & 0xFF) ||
+       from->sin6_family != AF_INET6 || ntohs(from->sin6_port) != port) {
+        fprintf(stderr, "FAIL: datagram %d: got %u, length %d.\n",
+                seqno, n, len);
+        return -1;
+    }
+    return 0;
+}
+
+/* Receive PACKETS datagrams, n at a time, or with babel_recv if n is 0.
+   Returns the number of calls. */
+static int
+receive_packets(int s, int n, int port, int seqno)
+{
+    int got = 0, calls = 0, i, rc;
+
+    while(got < PACKETS) {
+        if(n == 0) {
+            rc = babel_recv(s, buf, MAXLEN, (struct sockaddr*)sins,
+                            sizeof(sins[0]));
+            if(rc >= 0) {
+                lens[0] = rc;
+                rc = 1;
+            }
+        } else {
+            rc = babel_recv_multi(s, buf, MAXLEN, sins, sizeof(sins[0]),
+                                  lens, n);
+        }
+        calls++;
+        if(rc <= 0) {
+            fprintf(stderr, "FAIL: %d datagrams lost.\n", PACKETS - got);
+            return -1;
+        }
+        for(i = 0; i < rc; i++) {
+            if(check_packet(buf + i * MAXLEN, lens[i], &sins[i],
+                            port, seqno + got + i) < 0)
+                return -1;
+        }
+        got += rc;
+    }
+    return calls;
+}
+
+int
+main(void)
+{
+    static const int batches[] = {0, 1, 4, 16, 64};
+    struct sockaddr_in6 to;
+    socklen_t len;
+    int r, s, b, i, rc, port, calls, seqno = 0, size = 1024 * 1024;
+    double t0, t;
+
+    r = babel_socket(0);
+    s = babel_socket(0);
+    if(r < 0 || s < 0) {
+        perror("babel_socket");
+        return 1;
+    }
+    setsockopt(r, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    len = sizeof(to);
+    rc = getsockname(s, (struct sockaddr*)&to, &len);
+    if(rc < 0) {
+        perror("getsockname");
+        return 1;
+    }
+    port = ntohs(to.sin6_port);
+    len = sizeof(to);
+    rc = getsockname(r, (struct sockaddr*)&to, &len);
+    if(rc < 0) {
+        perror("getsockname");
+        return 1;
+    }
+    to.sin6_addr = in6addr_loopback;
+
+    printf("batch      ns/packet  calls/%d packets\n", PACKETS);
+    for(b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+        t = 0;
+        calls = 0;
+        for(i = 0; i < ROUNDS; i++) {
+            if(send_packets(s, &to, seqno) < 0)
+                return 1;
+            t0 = bench_time();
+            rc = receive_packets(r, batches[b], port, seqno);
+            t += bench_time() - t0;
+            if(rc < 0)
+                return 1;
+            calls += rc;
+            seqno += PACKETS;
+        }
+        if(batches[b] == 0)
+            printf("recvmsg    ");
+        else
+            printf("%-9d  ", batches[b]);
+        printf("%9.0f  %.1f\n", t / ROUNDS / PACKETS * 1E9,
+               (double)calls / ROUNDS);
+    }
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Cost of the route table operations as the number of prefixes grows:
+   insertion and lookup in the prefix trie, compared with a binary search
+   in a sorted array like the one that the trie replaced, and the walk done
+   by update_interface_metric and flush_interface_routes, compared with the
+   scan of the whole table that they used to do.  Finally, with one route
+   in a hundred installed, the cost of enumerating the installed routes,
+   compared with visiting every slot. */
+
+#include "../route.c"
+
+#include "bench.h"
+
+#define LOOKUPS 1000000
+#define INTERFACES 40
+
+static struct interface interfaces_array[INTERFACES];
+static struct neighbour neighbours_array[INTERFACES];
+
+static void
+make_prefix(unsigned char *prefix, int i)
+{
+    /* 2001:db8:i::/64 */
+    memset(prefix, 0, 16);
+    memcpy(prefix, "\x20\x01\x0d\xb8", 4);
+    DO_HTONL(prefix + 4, i);
+}
+
+static int
+compare_prefixes(const void *a, const void *b)
+{
+    return memcmp(a, b, 16);
+}
+
+static unsigned char *
+array_find(unsigned char *array, int n, const unsigned char *prefix)
+{
+    int lo = 0, hi = n - 1, mid, c;
+
+    while(lo <= hi) {
+        mid = (lo + hi) / 2;
+        c = memcmp(prefix, array + 16 * mid, 16);
+        if(c == 0)
+            return array + 16 * mid;
+        else if(c < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return NULL;
+}
+
+/* What update_interface_metric and flush_interface_routes walk. */
+static int
+walk_interface(struct interface *ifp)
+{
+    struct neighbour *neigh;
+    struct babel_route *r;
+    int count = 0;
+
+    FOR_ALL_INTERFACE_NEIGHBOURS(ifp, neigh) {
+        for(r = neigh->routes; r; r = r->neigh_next)
+            count++;
+    }
+    return count;
+}
+
+/* What they used to walk. */
+static int
+scan_table(struct interface *ifp)
+{
+    struct route_stream *routes;
+    struct babel_route *r;
+    int count = 0;
+
+    routes = route_stream(0);
+    while((r = route_stream_next(routes)) != NULL) {
+        if(r->neigh->ifp == ifp)
+            count++;
+    }
+    route_stream_done(routes);
+    return count;
+}
+
+/* What route_stream(1) used to do. */
+static int
+scan_installed(void)
+{
+    struct trie_node *dst = NULL, *slot = NULL;
+    int count = 0;
+
+    while((slot = trie_next_sub(route_trie, &dst, slot, 0)) != NULL) {
+        if(slot_installed(slot))
+            count++;
+    }
+    return count;
+}
+
+static int
+stream_installed(void)
+{
+    struct route_stream *routes;
+    int count = 0;
+
+    routes = route_stream(1);
+    while(route_stream_next(routes) != NULL)
+        count++;
+    route_stream_done(routes);
+    return count;
+}
+
+#define NUMSIZES 4
+
+int
+main(void)
+{
+    static const int sizes[NUMSIZES] = {1000, 10000, 100000, 1000000};
+    double stream[NUMSIZES], slots[NUMSIZES];
+    unsigned char id[8], prefix[16];
+    int s, i, j, n, scans;
+    double t0, insert, lookup, array, walk, scan, flush;
+
+    srandom(42);
+    bench_random_bytes(id, 8);
+    for(i = 0; i < INTERFACES; i++) {
+        struct interface *ifp = &interfaces_array[i];
+        struct neighbour *neigh = &neighbours_array[i];
+        snprintf(ifp->name, IF_NAMESIZE, "eth%d", i);
+        ifp->neighbours = neigh;
+        neigh->ifp = ifp;
+        bench_random_bytes(neigh->address, 16);
+    }
+
+    printf("prefixes  insert  trie lookup  array lookup  "
+           "interface walk  table scan  flush\n");
+    printf("          (ns)    (ns)         (ns)          "
+           "(us)            (us)        (ns)\n");
+
+    for(s = 0; s < NUMSIZES; s++) {
+        struct babel_route **routes;
+        unsigned char *sorted;
+        int *order;
+
+        n = sizes[s];
+        routes = malloc(n * sizeof(struct babel_route*));
+        sorted = malloc(n * 16);
+        order = malloc(MAX(n, LOOKUPS) * sizeof(int));
+        if(routes == NULL || sorted == NULL || order == NULL) {
+            perror("malloc");
+            return 1;
+        }
+
+        /* Insert in random order. */
+        for(i = 0; i < n; i++)
+            order[i] = i;
+        for(i = n - 1; i > 0; i--) {
+            int k = random() % (i + 1), tmp = order[i];
+            order[i] = order[k];
+            order[k] = tmp;
+        }
+
+        t0 = bench_time();
+        for(i = 0; i < n; i++) {
+            struct babel_route *route;
+            struct neighbour *neigh = &neighbours_array[i % INTERFACES];
+            make_prefix(prefix, order[i]);
+            route = pool_alloc(sizeof(struct babel_route));
+            if(route == NULL) {
+                perror("malloc(route)");
+                return 1;
+            }
+            memset(route, 0, sizeof(struct babel_route));
+            route->src = find_source(id, prefix, 64, zeroes, 0, 1, 0);
+            if(route->src == NULL)
+                return 1;
+            retain_source(route->src);
+            route->neigh = neigh;
+            route->nexthop = neigh->address;
+            route->refmetric = 96;
+            route->hold_time = 60;
+            if(insert_route(route) == NULL)
+                return 1;
+            routes[i] = route;
+        }
+        insert = (bench_time() - t0) / n;
+
+        for(i = 0; i < n; i++)
+            make_prefix(sorted + 16 * i, i);
+        qsort(sorted, n, 16, compare_prefixes);
+        for(i = 0; i < LOOKUPS; i++)
+            order[i] = random() % n;
+
+        t0 = bench_time();
+        for(i = 0; i < LOOKUPS; i++) {
+            make_prefix(prefix, order[i]);
+            if(find_route_slot(prefix, 64, zeroes, 0) == NULL)
+                return 1;
+        }
+        lookup = (bench_time() - t0) / LOOKUPS;
+
+        t0 = bench_time();
+        for(i = 0; i < LOOKUPS; i++) {
+            make_prefix(prefix, order[i]);
+            if(array_find(sorted, n, prefix) == NULL)
+                return 1;
+        }
+        array = (bench_time() - t0) / LOOKUPS;
+
+        t0 = bench_time();
+        for(i = 0; i < INTERFACES; i++)
+            walk_interface(&interfaces_array[i]);
+        walk = (bench_time() - t0) / INTERFACES;
+
+        scans = MAX(MIN(INTERFACES, 10000000 / n), 1);
+        t0 = bench_time();
+        for(i = 0; i < scans; i++) {
+            j = scan_table(&interfaces_array[i]);
+            if(j != walk_interface(&interfaces_array[i]))
+                return 1;
+        }
+        scan = (bench_time() - t0) / scans;
+
+        /* Pretend to install one route in a hundred. */
+        for(i = 0; i < n; i += 100) {
+            routes[i]->installed = 1;
+            count_installed_route(routes[i], 1);
+        }
+        t0 = bench_time();
+        for(i = 0; i < 10; i++) {
+            if(stream_installed() != (n + 99) / 100)
+                return 1;
+        }
+        stream[s] = (bench_time() - t0) / 10;
+        t0 = bench_time();
+        if(scan_installed() != (n + 99) / 100)
+            return 1;
+        slots[s] = bench_time() - t0;
+        for(i = 0; i < n; i += 100) {
+            routes[i]->installed = 0;
+            count_installed_route(routes[i], -1);
+        }
+
+        t0 = bench_time();
+        for(i = 0; i < n; i++)
+            flush_route(routes[i]);
+        flush = (bench_time() - t0) / n;
+        expire_sources();
+
+        printf("%8d  %6.0f  %11.0f  %12.0f  %14.1f  %10.1f  %5.0f\n", n,
+               insert * 1E9, lookup * 1E9, array * 1E9,
+               walk * 1E6, scan * 1E6, flush * 1E9);
+
+        free(order);
+        free(sorted);
+        free(routes);
+    }
+
+    printf("\nprefixes  installed  installed stream  slot scan\n");
+    printf("                     (us)              (us)\n");
+    for(s = 0; s < NUMSIZES; s++)
+        printf("%8d  %9d  %16.1f  %9.1f\n", sizes[s], (sizes[s] + 99) / 100,
+               stream[s] * 1E6, slots[s] * 1E6);
+    return 0;
+}
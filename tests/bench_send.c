@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Check that babel_send_multi delivers its datagrams in order and intact,
+   and time it for several batch sizes against one babel_send per
+   datagram.  The datagrams are sent over the loopback, and received and
+   checked after the timer is stopped. */
+
+#define BABEL_SEND_BATCH 64
+#include "../net.c"
+
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define PACKETS 64
+#define ROUNDS 2000
+#define MAXLEN 1500
+
+static unsigned char packets[MAXLEN * PACKETS];
+static int lens[PACKETS];
+
+static unsigned char buf[MAXLEN * BABEL_RECV_BATCH];
+static struct sockaddr_in6 sins[BABEL_RECV_BATCH];
+static int rlens[BABEL_RECV_BATCH];
+
+static int
+packet_len(int seqno)
+{
+    return 100 + (seqno * 37) % 1300;
+}
+
+static void
+make_packets(int seqno)
+{
+    int i;
+
+    for(i = 0; i < PACKETS; i++) {
+        unsigned char *packet = packets + i * MAXLEN;
+        lens[i] = packet_len(seqno + i);
+        DO_HTONL(packet, seqno + i);
+        memset(packet + 4, (seqno + i) & 0xFF, lens[i] - 4);
+    }
+}
+
+/* Send PACKETS datagrams, n at a time, or with babel_send if n is 0. */
+static int
+send_packets(int s, int n, struct sockaddr_in6 *to)
+{
+    int i, rc;
+
+    for(i = 0; i < PACKETS; i += (n == 0 ? 1 : n)) {
+        if(n == 0)
+            rc = babel_send(s, packets + i * MAXLEN, lens[i], NULL, 0,
+                            (struct sockaddr*)to, sizeof(*to));
+        else
+            rc = babel_send_multi(s, packets + i * MAXLEN, MAXLEN, lens + i,
+                                  MIN(n, PACKETS - i),
+                                  (struct sockaddr*)to, sizeof(*to));
+        if(rc < 0) {
+            perror("send");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+check_packets(int r, int port, int seqno)
+{
+    int got = 0, i, rc;
+    unsigned int n;
+
+    while(got < PACKETS) {
+        rc = babel_recv_multi(r, buf, MAXLEN, sins, sizeof(sins[0]),
+                              rlens, BABEL_RECV_BATCH);
+        if(rc <= 0) {
+            fprintf(stderr, "FAIL: %d datagrams lost.\n", PACKETS - got);
+            return -1;
+        }
+        for(i = 0; i < rc; i++) {
+            const unsigned char *packet = buf + i * MAXLEN;
+            int len = rlens[i];
+            DO_NTOHL(n, packet);
+            if(n != seqno + got + i || len != packet_len(n) ||
+               packet[len - 1] != (n & 0xFF) ||
+               ntohs(sins[i].sin6_port) != port) {
+                fprintf(stderr, "FAIL: datagram %d: got %u, length %d.\n",
+                        seqno + got + i, n, len);
+                return -1;
+            }
+        }
+        got += rc;
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    static const int batches[] = {0, 1, 4, 16, 64};
+    struct sockaddr_in6 to;
+    socklen_t len;
+    int r, s, b, i, rc, port, seqno = 0, size = 1024 * 1024;
+    double t0, t;
+
+    r = babel_socket(0);
+    s = babel_socket(0);
+    if(r < 0 || s < 0) {
+        perror("babel_socket");
+        return 1;
+    }
+    setsockopt(r, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    len = sizeof(to);
+    rc = getsockname(s, (struct sockaddr*)&to, &len);
+    if(rc < 0) {
+        perror("getsockname");
+        return 1;
+    }
+    port = ntohs(to.sin6_port);
+    len = sizeof(to);
+    rc = getsockname(r, (struct sockaddr*)&to, &len);
+    if(rc < 0) {
+        perror("getsockname");
+        return 1;
+    }
+    to.sin6_addr = in6addr_loopback;
+
+    printf("batch      ns/packet\n");
+    for(b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+        t = 0;
+        for(i = 0; i < ROUNDS; i++) {
+            make_packets(seqno);
+            t0 = bench_time();
+            rc = send_packets(s, batches[b], &to);
+            t += bench_time() - t0;
+            if(rc < 0 || check_packets(r, port, seqno) < 0)
+                return 1;
+            seqno += PACKETS;
+        }
+        if(batches[b] == 0)
+            printf("sendmsg    ");
+        else
+            printf("%-9d  ", batches[b]);
+        printf("%9.0f\n", t / ROUNDS / PACKETS * 1E9);
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Per-operation cost of the source table as the number of sources grows,
+   compared with the linked list that it replaced. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "babeld.h"
+#include "util.h"
+#include "source.h"
+#include "bench.h"
+
+#define LOOKUPS 1000000
+#define ROUTERS 64
+
+struct key {
+    unsigned char id[8];
+    unsigned char prefix[16];
+};
+
+/* The list walk that find_source used to do. */
+
+struct list_source {
+    struct list_source *next;
+    unsigned char id[8];
+    unsigned char prefix[16];
+    unsigned char plen;
+    unsigned char src_prefix[16];
+    unsigned char src_plen;
+};
+
+static struct list_source *
+list_find(struct list_source *srcs, const unsigned char *id,
+          const unsigned char *prefix, unsigned char plen,
+          const unsigned char *src_prefix, unsigned char src_plen)
+{
+    struct list_source *src;
+
+    for(src = srcs; src; src = src->next) {
+        if(src->id[7] != id[7])
+            continue;
+        if(memcmp(src->id, id, 8) != 0)
+            continue;
+        if(src->plen != plen)
+            continue;
+        if(src->src_plen != src_plen)
+            continue;
+        if(memcmp(src->prefix, prefix, 16) != 0)
+            continue;
+        if(memcmp(src->src_prefix, src_prefix, 16) == 0)
+            return src;
+    }
+    return NULL;
+}
+
+static void
+make_keys(struct key *keys, int n)
+{
+    unsigned char ids[ROUTERS][8];
+    int i;
+
+    for(i = 0; i < ROUTERS; i++)
+        bench_random_bytes(ids[i], 8);
+    for(i = 0; i < n; i++) {
+        memcpy(keys[i].id, ids[random() % ROUTERS], 8);
+        /* 2001:db8:i::/64, so that the keys are distinct. */
+        memset(keys[i].prefix, 0, 16);
+        memcpy(keys[i].prefix, "\x20\x01\x0d\xb8", 4);
+        DO_HTONL(keys[i].prefix + 4, i);
+    }
+}
+
+int
+main(void)
+{
+    static const int sizes[] = {1000, 10000, 100000, 1000000};
+    int s, i, n, lookups;
+    double t0, insert, lookup, flush, list;
+
+    srandom(42);
+    printf("sources    insert   lookup+update    flush   list lookup "
+           "(ns per operation)\n");
+
+    for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        struct key *keys;
+        struct source **srcs;
+        struct list_source *head = NULL, *l;
+        int *order;
+
+        n = sizes[s];
+        keys = malloc(n * sizeof(struct key));
+        srcs = malloc(n * sizeof(struct source*));
+        order = malloc(LOOKUPS * sizeof(int));
+        if(keys == NULL || srcs == NULL || order == NULL) {
+            perror("malloc");
+            return 1;
+        }
+        make_keys(keys, n);
+        for(i = 0; i < LOOKUPS; i++)
+            order[i] = random() % n;
+
+        t0 = bench_time();
+        for(i = 0; i < n; i++) {
+            srcs[i] = find_source(keys[i].id, keys[i].prefix, 64,
+                                  zeroes, 0, 1, 0);
+            if(srcs[i] == NULL)
+                return 1;
+        }
+        insert = (bench_time() - t0) / n;
+
+        t0 = bench_time();
+        for(i = 0; i < LOOKUPS; i++) {
+            struct key *k = &keys[order[i]];
+            struct source *src =
+                find_source(k->id, k->prefix, 64, zeroes, 0, 0, 0);
+            update_source(src, i & 0xFFFF, 96);
+        }
+        lookup = (bench_time() - t0) / LOOKUPS;
+
+        t0 = bench_time();
+        for(i = 0; i < n; i++)
+            flush_source(srcs[i]);
+        flush = (bench_time() - t0) / n;
+
+        for(i = 0; i < n; i++) {
+            l = malloc(sizeof(struct list_source));
+            if(l == NULL) {
+                perror("malloc");
+                return 1;
+            }
+            memcpy(l->id, keys[i].id, 8);
+            memcpy(l->prefix, keys[i].prefix, 16);
+            l->plen = 64;
+            memset(l->src_prefix, 0, 16);
+            l->src_plen = 0;
+            l->next = head;
+            head = l;
+        }
+        /* Keep the list walks to about 10^8 entries. */
+        lookups = MAX(MIN(LOOKUPS, 100000000 / n), 100);
+        t0 = bench_time();
+        for(i = 0; i < lookups; i++) {
+            struct key *k = &keys[order[i]];
+            if(list_find(head, k->id, k->prefix, 64, zeroes, 0) == NULL)
+                return 1;
+        }
+        list = (bench_time() - t0) / lookups;
+
+        printf("%7d  %8.0f  %14.0f  %8.0f  %12.0f\n", n,
+               insert * 1E9, lookup * 1E9, flush * 1E9, list * 1E9);
+
+        while(head) {
+            l = head->next;
+            free(head);
+            head = l;
+        }
+        free(order);
+        free(srcs);
+        free(keys);
+    }
+    return 0;
+}
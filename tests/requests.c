@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Check that a forwarded request records every neighbour that asks for it,
+   is forwarded once, is answered on the interfaces of the neighbours that
+   asked, and is only satisfied once all of them have been answered. */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../babeld.h"
+#include "../interface.h"
+#include "../neighbour.h"
+#include "../resend.h"
+
+static struct interface ifs[3];
+static struct neighbour neighbours[3];
+
+static const unsigned char prefix[16] =
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 10, 0, 0, 0};
+static const unsigned char id[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+static int failed = 0;
+
+static void
+check(int ok, const char *what)
+{
+    if(!ok) {
+        printf("FAIL: %s\n", what);
+        failed = 1;
+    }
+}
+
+int
+main(void)
+{
+    int i, rc;
+
+    gettimeofday(&now, NULL);
+
+    for(i = 0; i < 3; i++) {
+        snprintf(ifs[i].name, IF_NAMESIZE, "if%d", i);
+        ifs[i].flags = IF_UP;
+        ifs[i].update_interval = 4000;
+        ifs[i].next = i < 2 ? &ifs[i + 1] : NULL;
+        neighbours[i].ifp = &ifs[i];
+        neighbours[i].address[0] = 0xFE;
+        neighbours[i].address[1] = 0x80;
+        neighbours[i].address[15] = i + 1;
+    }
+    interfaces = &ifs[0];
+
+    /* Neighbours 0 and 1 ask for a seqno that we forward to neighbour 2. */
+    rc = record_forwarded_request(&neighbours[0], &neighbours[2],
+                                  prefix, 120, zeroes, 0, 42, id);
+    check(rc == 1, "first request is forwarded");
+    rc = record_forwarded_request(&neighbours[1], &neighbours[2],
+                                  prefix, 120, zeroes, 0, 42, id);
+    check(rc == 0, "second request is coalesced");
+    check(unsatisfied_request(prefix, 120, zeroes, 0, 42, id),
+          "request is pending");
+
+    /* The update is sent on the interfaces of the requesters only. */
+    rc = send_update_requesters(prefix, 120, zeroes, 0);
+    check(rc == 2, "update sent on two interfaces");
+    check(ifs[0].num_buffered_updates == 1 &&
+          ifs[1].num_buffered_updates == 1 &&
+          ifs[2].num_buffered_updates == 0,
+          "update buffered on the requesters' interfaces");
+
+    /* Flushing it on one interface leaves the other requester waiting. */
+    satisfy_request(prefix, 120, zeroes, 0, 42, id, &ifs[0]);
+    check(unsatisfied_request(prefix, 120, zeroes, 0, 42, id),
+          "request pending after the first interface");
+    satisfy_request(prefix, 120, zeroes, 0, 42, id, &ifs[1]);
+    check(!unsatisfied_request(prefix, 120, zeroes, 0, 42, id),
+          "request satisfied after both interfaces");
+
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Check route_smoothed_metric against the exact exponential and against
+   the per-second loop that it replaced.
+
+   With the randomisation disabled, the smoothed metric must be within
+   4 + |gap| / 256 of metric - gap * 2^(-age/half_life): 3 for the final
+   snap to the metric, 1 for truncation, and |gap| / 256 for the
+   quantisation of the fractional half-life to 1/256.  The old loop is
+   only reported, since it decays faster than the half-life and stalls
+   when a one-second step rounds to zero.  With the randomisation, the
+   smoothed metric must never move past the metric. */
+
+#define roughly check_roughly
+#include "../route.c"
+#undef roughly
+
+#include <math.h>
+
+int roughly(int value);
+
+static int randomise = 0;
+
+int
+check_roughly(int value)
+{
+    return randomise ? roughly(value) : value;
+}
+
+/* The code replaced by exp2_table. */
+
+static int
+old_two_to_the_one_over_hl(int half_life)
+{
+    switch(half_life) {
+    case 1: return 131072;
+    case 2: return 92682;
+    case 3: return 82570;
+    case 4: return 77935;
+    default:
+        /* 2^(1/x) is 1 + log(2)/x + O(1/x^2) at infinity. */
+        return 0x10000 + 45426 / half_life;
+    }
+}
+
+static int
+old_smoothed_metric(int smoothed, int metric, int half_life, int age)
+{
+    int t = old_two_to_the_one_over_hl(half_life);
+    int diff;
+
+    while(age >= half_life) {
+        diff = metric - smoothed;
+        smoothed += check_roughly(diff) / 2;
+        age -= half_life;
+    }
+    while(age > 0) {
+        diff = metric - smoothed;
+        smoothed += check_roughly(diff) * (t - 0x10000) / 0x10000;
+        age--;
+    }
+
+    diff = metric - smoothed;
+    if(diff > -4 && diff < 4)
+        smoothed = metric;
+    return smoothed;
+}
+
+static int
+new_smoothed_metric(int smoothed, int metric, int half_life, int age)
+{
+    struct babel_route route;
+
+    change_smoothing_half_life(half_life);
+    memset(&route, 0, sizeof(route));
+    route.refmetric = metric;
+    route.smoothed_metric = smoothed;
+    now.tv_sec = 1000000;
+    route.smoothed_metric_time = now.tv_sec - age;
+    return route_smoothed_metric(&route);
+}
+
+static const int half_lives[] = {1, 2, 3, 4, 8, 16, 60, 300, 1000};
+static const int ages[] = {1, 2, 3, 5, 7, 10, 30, 60, 100, 300, 1000, 10000};
+static const int gaps[] = {4, 10, 96, 256, 1000, 4096, 30000};
+
+#define BASE 256
+
+int
+main(void)
+{
+    int h, a, g, s, i, failed = 0;
+
+    printf("half-life  max |old - exact|  max |new - exact|  "
+           "max |new - old|\n");
+
+    for(h = 0; h < sizeof(half_lives) / sizeof(half_lives[0]); h++) {
+        int hl = half_lives[h];
+        double old_err = 0, new_err = 0, new_old = 0;
+        for(a = 0; a < sizeof(ages) / sizeof(ages[0]); a++) {
+            for(g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++) {
+                for(s = -1; s <= 1; s += 2) {
+                    int gap = s * gaps[g];
+                    int metric = s > 0 ? BASE + gap : BASE;
+                    int smoothed = metric - gap;
+                    double exact =
+                        metric - gap * pow(2, -(double)ages[a] / hl);
+                    int old_sm, new_sm;
+
+                    randomise = 0;
+                    old_sm = old_smoothed_metric(smoothed, metric,
+                                                 hl, ages[a]);
+                    new_sm = new_smoothed_metric(smoothed, metric,
+                                                 hl, ages[a]);
+                    old_err = MAX(old_err, fabs(old_sm - exact));
+                    new_err = MAX(new_err, fabs(new_sm - exact));
+                    new_old = MAX(new_old, abs(new_sm - old_sm));
+                    if(fabs(new_sm - exact) > 4 + gaps[g] / 256.0) {
+                        printf("FAIL: half-life %d age %d gap %d: "
+                               "%d, expected %.1f\n",
+                               hl, ages[a], gap, new_sm, exact);
+                        failed = 1;
+                    }
+
+                    randomise = 1;
+                    for(i = 0; i < 100; i++) {
+                        new_sm = new_smoothed_metric(smoothed, metric,
+                                                     hl, ages[a]);
+                        if(s > 0 ? new_sm > metric || new_sm < smoothed :
+                           new_sm < metric || new_sm > smoothed) {
+                            printf("FAIL: half-life %d age %d gap %d: "
+                                   "randomised %d overshoots\n",
+                                   hl, ages[a], gap, new_sm);
+                            failed = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        printf("%9d  %17.1f  %17.1f  %15.0f\n",
+               hl, old_err, new_err, new_old);
+    }
+
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
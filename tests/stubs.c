@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* The globals and helpers that babeld.c provides to the rest of the
+   daemon, so that the programs in this directory can be linked against
+   the other object files without a main loop. */
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "babeld.h"
+
+struct timeval now;
+
+unsigned char myid[8];
+int debug = 0;
+
+int link_detect = 0;
+int all_wireless = 0;
+int default_wireless_hello_interval = -1;
+int default_wired_hello_interval = -1;
+int resend_delay = -1;
+int random_id = 0;
+int do_daemonise = 0;
+const char *logfile = NULL, *pidfile = NULL, *state_file = NULL;
+
+const unsigned char zeroes[16] = {0};
+
+int protocol_port;
+unsigned char protocol_group[16];
+char allow_generic_redistribution = 0;
+int protocol_socket = -1;
+int kernel_socket = -1;
+
+void
+schedule_neighbours_check(int msecs, int override)
+{
+}
+
+void
+schedule_interfaces_check(int msecs, int override)
+{
+}
+
+int
+resize_receive_buffer(int size)
+{
+    return 0;
+}
@@ -0,0 +1,341 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <assert.h>
+
+#include "babeld.h"
+#include "util.h"
+#include "trie.h"
+#include "pool.h"
+
+static inline int
+prefix_bit(const unsigned char *prefix, int i)
+{
+    return (prefix[i / 8] >> (7 - i % 8)) & 1;
+}
+
+/* Returns the number of leading bits common to a and b, at most max. */
+static int
+common_bits(const unsigned char *a, const unsigned char *b, int max)
+{
+    unsigned char x;
+    int i, n;
+
+    for(i = 0; i < 16 && i * 8 < max; i++) {
+        if(a[i] != b[i])
+            break;
+    }
+    n = i * 8;
+    if(n >= max)
+        return max;
+
+    x = a[i] ^ b[i];
+    while(!(x & 0x80)) {
+        x <<= 1;
+        n++;
+    }
+    return MIN(n, max);
+}
+
+static struct trie_node *
+make_node(const unsigned char *prefix, unsigned char plen,
+          struct trie_node *parent)
+{
+    struct trie_node *node;
+
+    node = pool_alloc(sizeof(struct trie_node));
+    if(node == NULL) {
+        perror("malloc(trie_node)");
+        return NULL;
+    }
+    memset(node, 0, sizeof(struct trie_node));
+    mask_prefix(node->prefix, prefix, plen);
+    node->plen = plen;
+    node->parent = parent;
+    return node;
+}
+
+static struct trie_node **
+node_link(struct trie_node **root, struct trie_node *node)
+{
+    if(node->parent == NULL)
+        return root;
+    else if(node->parent->child[0] == node)
+        return &node->parent->child[0];
+    else
+        return &node->parent->child[1];
+}
+
+#define child_count(_node, _i) \
+    ((_node)->child[_i] ? (_node)->child[_i]->count : 0)
+
+/* Whether some of the marked entries counted at node are its own rather
+   than its children's. */
+static int
+node_counted(struct trie_node *node)
+{
+    return node->count > child_count(node, 0) + child_count(node, 1);
+}
+
+/* Exact match.  Returns NULL if the node doesn't exist or is unused. */
+struct trie_node *
+trie_find(struct trie_node *root,
+          const unsigned char *prefix, unsigned char plen)
+{
+    struct trie_node *node = root;
+
+    while(node) {
+        if(node->plen > plen ||
+           common_bits(node->prefix, prefix, node->plen) < node->plen)
+            return NULL;
+        if(node->plen == plen)
+            return trie_node_used(node) ? node : NULL;
+        node = node->child[prefix_bit(prefix, node->plen)];
+    }
+    return NULL;
+}
+
+/* Returns the node for the given prefix, creating it if necessary.  The
+   caller must make the node used, or release it. */
+struct trie_node *
+trie_insert(struct trie_node **root,
+            const unsigned char *prefix, unsigned char plen)
+{
+    struct trie_node **link = root, *parent = NULL, *node, *new, *glue;
+    int common;
+
+    while((node = *link) != NULL) {
+        common = common_bits(node->prefix, prefix, MIN(node->plen, plen));
+        if(common == node->plen) {
+            if(node->plen == plen)
+                return node;
+            /* The node covers the prefix, go down. */
+            parent = node;
+            link = &node->child[prefix_bit(prefix, node->plen)];
+            continue;
+        }
+
+        new = make_node(prefix, plen, parent);
+        if(new == NULL)
+            return NULL;
+
+        if(common == plen) {
+            /* The new prefix covers the node, insert it above. */
+            new->count = node->count;
+            new->child[prefix_bit(node->prefix, plen)] = node;
+            node->parent = new;
+            *link = new;
+            return new;
+        }
+
+        /* The prefixes diverge, insert a branching point. */
+        glue = make_node(prefix, common, parent);
+        if(glue == NULL) {
+            pool_free(new, sizeof(struct trie_node));
+            return NULL;
+        }
+        glue->count = node->count;
+        glue->child[prefix_bit(prefix, common)] = new;
+        glue->child[prefix_bit(node->prefix, common)] = node;
+        new->parent = glue;
+        node->parent = glue;
+        *link = glue;
+        return new;
+    }
+
+    new = make_node(prefix, plen, parent);
+    if(new == NULL)
+        return NULL;
+    *link = new;
+    return new;
+}
+
+/* Remove a node that is no longer used, together with any branching point
+   that became useless. */
+void
+trie_release(struct trie_node **root, struct trie_node *node)
+{
+    struct trie_node *parent, *child;
+
+    if(trie_node_used(node) || (node->child[0] && node->child[1]))
+        return;
+    assert(!node_counted(node));
+
+    parent = node->parent;
+    child = node->child[0] ? node->child[0] : node->child[1];
+    *node_link(root, node) = child;
+    if(child)
+        child->parent = parent;
+    pool_free(node, sizeof(struct trie_node));
+
+    if(child == NULL && parent != NULL && !trie_node_used(parent))
+        trie_release(root, parent);
+}
+
+/* Longest prefix match: the most specific used node covering the given
+   prefix. */
+struct trie_node *
+trie_match(struct trie_node *root,
+           const unsigned char *prefix, unsigned char plen)
+{
+    struct trie_node *node = root, *best = NULL;
+
+    while(node) {
+        if(node->plen > plen ||
+           common_bits(node->prefix, prefix, node->plen) < node->plen)
+            break;
+        if(trie_node_used(node))
+            best = node;
+        if(node->plen == plen)
+            break;
+        node = node->child[prefix_bit(prefix, node->plen)];
+    }
+    return best;
+}
+
+/* The most specific used node strictly covering the given node. */
+struct trie_node *
+trie_parent(struct trie_node *node)
+{
+    node = node->parent;
+    while(node && !trie_node_used(node))
+        node = node->parent;
+    return node;
+}
+
+/* Pre-order traversal, which yields prefixes in lexicographic order with
+   every prefix before the prefixes it covers. */
+static struct trie_node *
+preorder_next(struct trie_node *node)
+{
+    if(node->child[0])
+        return node->child[0];
+    if(node->child[1])
+        return node->child[1];
+    while(node->parent) {
+        if(node == node->parent->child[0] && node->parent->child[1])
+            return node->parent->child[1];
+        node = node->parent;
+    }
+    return NULL;
+}
+
+struct trie_node *
+trie_first(struct trie_node *root)
+{
+    if(root == NULL || trie_node_used(root))
+        return root;
+    return trie_next(root);
+}
+
+struct trie_node *
+trie_next(struct trie_node *node)
+{
+    do {
+        node = preorder_next(node);
+    } while(node && !trie_node_used(node));
+    return node;
+}
+
+/* Like preorder_next, but skipping the subtrees with a null count. */
+static struct trie_node *
+preorder_next_counted(struct trie_node *node)
+{
+    if(child_count(node, 0) > 0)
+        return node->child[0];
+    if(child_count(node, 1) > 0)
+        return node->child[1];
+    while(node->parent) {
+        if(node == node->parent->child[0] && child_count(node->parent, 1) > 0)
+            return node->parent->child[1];
+        node = node->parent;
+    }
+    return NULL;
+}
+
+/* Traversal of the nodes with marked entries of their own, in the same
+   order as trie_first and trie_next.  The cost is proportional to the
+   number of such nodes times the depth of the trie, whatever its size. */
+struct trie_node *
+trie_first_counted(struct trie_node *root)
+{
+    if(root == NULL || root->count == 0)
+        return NULL;
+    if(node_counted(root))
+        return root;
+    return trie_next_counted(root);
+}
+
+struct trie_node *
+trie_next_counted(struct trie_node *node)
+{
+    do {
+        node = preorder_next_counted(node);
+    } while(node && !node_counted(node));
+    return node;
+}
+
+/* Traversal of the nodes of the second-level tries.  Returns the node
+   following node, or the first one if node is NULL.  *outer is the node of
+   the first-level trie whose sub contains node, and is updated.  If
+   counted is true, only the nodes with marked entries are returned, and
+   the subtrees without any are skipped.  The next node survives releasing
+   node, so it should be computed before doing that. */
+struct trie_node *
+trie_next_sub(struct trie_node *root, struct trie_node **outer,
+              struct trie_node *node, int counted)
+{
+    struct trie_node *next = NULL;
+
+    if(node)
+        next = counted ? trie_next_counted(node) : trie_next(node);
+
+    while(next == NULL) {
+        if(counted)
+            *outer = *outer ? trie_next_counted(*outer) :
+                trie_first_counted(root);
+        else
+            *outer = *outer ? trie_next(*outer) : trie_first(root);
+        if(*outer == NULL)
+            return NULL;
+        next = counted ?
+            trie_first_counted((*outer)->sub) : trie_first((*outer)->sub);
+    }
+    return next;
+}
+
+/* Mark or unmark delta entries at node.  This updates the count of node
+   and of its ancestors in its own trie; if the node belongs to a sub trie,
+   the caller must also count the entries at the node that holds it. */
+void
+trie_count(struct trie_node *node, int delta)
+{
+    while(node) {
+        assert(delta >= 0 || node->count >= -delta);
+        node->count += delta;
+        node = node->parent;
+    }
+}
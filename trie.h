@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2026 by the babeld contributors
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* A path-compressed binary trie of prefixes.  A node is in use if either
+   data or sub is non-NULL; unused nodes are only kept as branching points,
+   and always have two children.  The ancestors of a node are exactly the
+   nodes whose prefix covers it.  Sub is the root of a second trie, which
+   is used for the source prefix of source-specific routes.
+
+   Count is the number of entries marked with trie_count in the subtree
+   rooted at a node, including its sub trie; traversals can use it to skip
+   the subtrees that hold no marked entry. */
+
+struct trie_node {
+    struct trie_node *parent;
+    struct trie_node *child[2];
+    struct trie_node *sub;
+    void *data;
+    unsigned char prefix[16];
+    unsigned char plen;
+    unsigned int count;
+};
+
+#define trie_node_used(_node) ((_node)->data != NULL || (_node)->sub != NULL)
+
+struct trie_node *trie_find(struct trie_node *root,
+                            const unsigned char *prefix, unsigned char plen);
+struct trie_node *trie_insert(struct trie_node **root,
+                              const unsigned char *prefix, unsigned char plen);
+void trie_release(struct trie_node **root, struct trie_node *node);
+struct trie_node *trie_match(struct trie_node *root,
+                             const unsigned char *prefix, unsigned char plen);
+struct trie_node *trie_parent(struct trie_node *node);
+struct trie_node *trie_first(struct trie_node *root);
+struct trie_node *trie_next(struct trie_node *node);
+struct trie_node *trie_first_counted(struct trie_node *root);
+struct trie_node *trie_next_counted(struct trie_node *node);
+struct trie_node *trie_next_sub(struct trie_node *root,
+                                struct trie_node **outer,
+                                struct trie_node *node, int counted);
+void trie_count(struct trie_node *node, int delta);
@@ -38,90 +38,193 @@ THE SOFTWARE.
 #include "configuration.h"
 #include "interface.h"
 #include "local.h"
+#include "trie.h"
+#include "pool.h"
 
-static struct xroute *xroutes;
-static int numxroutes = 0, maxxroutes = 0;
+/* The exported routes are kept in a two-level trie, indexed by
+   destination and then source prefix, in the same way as the route
+   table. */
+
+static struct trie_node *xroute_trie = NULL;
+static int numxroutes = 0;
+
+static struct trie_node *
+find_xroute_slot(const unsigned char *prefix, unsigned char plen,
+                 const unsigned char *src_prefix, unsigned char src_plen)
+{
+    struct trie_node *dst = trie_find(xroute_trie, prefix, plen);
+
+    if(dst == NULL)
+        return NULL;
+
+    return trie_find(dst->sub, src_prefix, src_plen);
+}
 
 struct xroute *
 find_xroute(const unsigned char *prefix, unsigned char plen,
             const unsigned char *src_prefix, unsigned char src_plen)
 {
-    int i;
-    for(i = 0; i < numxroutes; i++) {
-        if(xroutes[i].plen == plen &&
-           memcmp(xroutes[i].prefix, prefix, 16) == 0 &&
-           xroutes[i].src_plen == src_plen &&
-           memcmp(xroutes[i].src_prefix, src_prefix, 16) == 0)
-            return &xroutes[i];
+    struct trie_node *slot =
+        find_xroute_slot(prefix, plen, src_prefix, src_plen);
+
+    return slot ? slot->data : NULL;
+}
+
+/* A kernel route or address that an xroute is exported from.  Every
+   one of them is kept, best first, so that the removal of one of them
+   falls back to the next without dumping the kernel tables. */
+struct xroute_origin {
+    struct xroute_origin *next;
+    unsigned short metric;
+    int kernel_metric;
+    unsigned int ifindex;
+    int proto;
+    unsigned char gw[16];
+};
+
+static void
+flush_origins(struct xroute *xroute)
+{
+    while(xroute->origins) {
+        struct xroute_origin *origin = xroute->origins;
+        xroute->origins = origin->next;
+        pool_free(origin, sizeof(struct xroute_origin));
     }
-    return NULL;
 }
 
 void
 flush_xroute(struct xroute *xroute)
 {
-    int i;
-
-    i = xroute - xroutes;
-    assert(i >= 0 && i < numxroutes);
+    struct trie_node *dst, *slot;
 
     local_notify_xroute(xroute, LOCAL_FLUSH);
 
-    if(i != numxroutes - 1)
-        memcpy(xroutes + i, xroutes + numxroutes - 1, sizeof(struct xroute));
+    dst = trie_find(xroute_trie, xroute->prefix, xroute->plen);
+    assert(dst != NULL);
+    slot = trie_find(dst->sub, xroute->src_prefix, xroute->src_plen);
+    assert(slot != NULL && slot->data == xroute);
+
+    slot->data = NULL;
+    trie_release(&dst->sub, slot);
+    if(dst->sub == NULL)
+        trie_release(&xroute_trie, dst);
+
+    flush_origins(xroute);
+    pool_free(xroute, sizeof(struct xroute));
     numxroutes--;
-    VALGRIND_MAKE_MEM_UNDEFINED(xroutes + numxroutes, sizeof(struct xroute));
-
-    if(numxroutes == 0) {
-        free(xroutes);
-        xroutes = NULL;
-        maxxroutes = 0;
-    } else if(maxxroutes > 8 && numxroutes < maxxroutes / 4) {
-        struct xroute *new_xroutes;
-        int n = maxxroutes / 2;
-        new_xroutes = realloc(xroutes, n * sizeof(struct xroute));
-        if(new_xroutes == NULL)
-            return;
-        xroutes = new_xroutes;
-        maxxroutes = n;
-    }
 }
 
-int
+/* Creates an xroute with no origins; the caller must add one. */
+static struct xroute *
 add_xroute(unsigned char prefix[16], unsigned char plen,
-           unsigned char src_prefix[16], unsigned char src_plen,
-           unsigned short metric, unsigned int ifindex, int proto)
+           unsigned char src_prefix[16], unsigned char src_plen)
 {
-    struct xroute *xroute = find_xroute(prefix, plen, src_prefix, src_plen);
-    if(xroute) {
-        if(xroute->metric <= metric)
-            return 0;
-        xroute->metric = metric;
-        local_notify_xroute(xroute, LOCAL_CHANGE);
-        return 1;
+    struct trie_node *dst, *slot;
+    struct xroute *xroute;
+
+    dst = trie_insert(&xroute_trie, prefix, plen);
+    if(dst == NULL)
+        return NULL;
+    slot = trie_insert(&dst->sub, src_prefix, src_plen);
+    if(slot == NULL) {
+        trie_release(&xroute_trie, dst);
+        return NULL;
     }
 
-    if(numxroutes >= maxxroutes) {
-        struct xroute *new_xroutes;
-        int n = maxxroutes < 1 ? 8 : 2 * maxxroutes;
-        new_xroutes = xroutes == NULL ?
-            malloc(n * sizeof(struct xroute)) :
-            realloc(xroutes, n * sizeof(struct xroute));
-        if(new_xroutes == NULL)
-            return -1;
-        maxxroutes = n;
-        xroutes = new_xroutes;
+    xroute = pool_alloc(sizeof(struct xroute));
+    if(xroute == NULL) {
+        trie_release(&dst->sub, slot);
+        if(dst->sub == NULL)
+            trie_release(&xroute_trie, dst);
+        return NULL;
     }
 
-    memcpy(xroutes[numxroutes].prefix, prefix, 16);
-    xroutes[numxroutes].plen = plen;
-    memcpy(xroutes[numxroutes].src_prefix, src_prefix, 16);
-    xroutes[numxroutes].src_plen = src_plen;
-    xroutes[numxroutes].metric = metric;
-    xroutes[numxroutes].ifindex = ifindex;
-    xroutes[numxroutes].proto = proto;
+    memcpy(xroute->prefix, prefix, 16);
+    xroute->plen = plen;
+    memcpy(xroute->src_prefix, src_prefix, 16);
+    xroute->src_plen = src_plen;
+    xroute->metric = INFINITY;
+    xroute->ifindex = 0;
+    xroute->proto = 0;
+    xroute->origins = NULL;
+    slot->data = xroute;
     numxroutes++;
-    local_notify_xroute(&xroutes[numxroutes - 1], LOCAL_ADD);
+    return xroute;
+}
+
+static int
+origin_match(const struct xroute_origin *origin,
+             const struct kernel_route *kroute)
+{
+    return origin->kernel_metric == kroute->metric &&
+        origin->ifindex == kroute->ifindex &&
+        origin->proto == kroute->proto &&
+        memcmp(origin->gw, kroute->gw, 16) == 0;
+}
+
+/* Removes the origin matching a kernel route.  Returns 1 if there was
+   one. */
+static int
+remove_origin(struct xroute *xroute, const struct kernel_route *kroute)
+{
+    struct xroute_origin **p = &xroute->origins;
+
+    while(*p) {
+        struct xroute_origin *origin = *p;
+        if(origin_match(origin, kroute)) {
+            *p = origin->next;
+            pool_free(origin, sizeof(struct xroute_origin));
+            return 1;
+        }
+        p = &origin->next;
+    }
+    return 0;
+}
+
+/* Records a kernel route as an origin of an xroute, replacing any origin
+   for the same kernel route.  Returns -1 on allocation failure. */
+static int
+add_origin(struct xroute *xroute, const struct kernel_route *kroute,
+           int metric)
+{
+    struct xroute_origin *origin, **p;
+
+    remove_origin(xroute, kroute);
+
+    origin = pool_alloc(sizeof(struct xroute_origin));
+    if(origin == NULL)
+        return -1;
+    origin->metric = metric;
+    origin->kernel_metric = kroute->metric;
+    origin->ifindex = kroute->ifindex;
+    origin->proto = kroute->proto;
+    memcpy(origin->gw, kroute->gw, 16);
+
+    p = &xroute->origins;
+    while(*p && (*p)->metric <= metric)
+        p = &(*p)->next;
+    origin->next = *p;
+    *p = origin;
+    return 0;
+}
+
+/* Takes the exported metric from the best origin.  Returns 1 if the
+   xroute changed. */
+static int
+select_origin(struct xroute *xroute)
+{
+    struct xroute_origin *best = xroute->origins;
+    int add = xroute->metric >= INFINITY;
+
+    assert(best != NULL);
+    if(xroute->metric == best->metric && xroute->ifindex == best->ifindex &&
+       xroute->proto == best->proto)
+        return 0;
+
+    xroute->metric = best->metric;
+    xroute->ifindex = best->ifindex;
+    xroute->proto = best->proto;
+    local_notify_xroute(xroute, add ? LOCAL_ADD : LOCAL_CHANGE);
     return 1;
 }
 
@@ -133,7 +236,8 @@ xroutes_estimate()
 }
 
 struct xroute_stream {
-    int index;
+    struct trie_node *dst;
+    struct trie_node *slot;
 };
 
 struct
@@ -144,7 +248,8 @@ xroute_stream()
     if(stream == NULL)
         return NULL;
 
-    stream->index = 0;
+    stream->dst = NULL;
+    stream->slot = NULL;
     return stream;
 }
 
@@ -152,10 +257,8 @@ xroute_stream()
 struct xroute *
 xroute_stream_next(struct xroute_stream *stream)
 {
-    if(stream->index < numxroutes)
-        return &xroutes[stream->index++];
-    else
-        return NULL;
+    stream->slot = trie_next_sub(xroute_trie, &stream->dst, stream->slot, 0);
+    return stream->slot ? stream->slot->data : NULL;
 }
 
 void
@@ -164,142 +267,311 @@ xroute_stream_done(struct xroute_stream *stream)
     free(stream);
 }
 
-int
-check_xroutes(int send_updates)
+/* A kernel route that passes the redistribution filters. */
+struct kernel_export {
+    struct kernel_route route;
+    int metric;
+};
+
+/* The routes collected by check_xroutes, in a growable array. */
+struct kernel_exports {
+    struct kernel_export *exports;
+    int numexports;
+    int maxexports;
+    int addresses;
+    int failed;
+};
+
+/* The order of the xroute table: by destination, then source prefix, where
+   a prefix comes before the prefixes it covers. */
+static int
+prefix_order(const unsigned char *p1, int plen1,
+             const unsigned char *p2, int plen2)
+{
+    int plen = MIN(plen1, plen2), bytes = plen / 8, rc;
+
+    rc = memcmp(p1, p2, bytes);
+    if(rc != 0)
+        return rc;
+    if(plen % 8 != 0) {
+        unsigned char mask = 0xFF << (8 - plen % 8);
+        rc = (p1[bytes] & mask) - (p2[bytes] & mask);
+        if(rc != 0)
+            return rc;
+    }
+    return plen1 - plen2;
+}
+
+static int
+xroute_compare(const struct xroute *xroute, const struct kernel_route *route)
+{
+    int rc = prefix_order(xroute->prefix, xroute->plen,
+                          route->prefix, route->plen);
+    if(rc != 0)
+        return rc;
+    return prefix_order(xroute->src_prefix, xroute->src_plen,
+                        route->src_prefix, route->src_plen);
+}
+
+static int
+export_compare(const void *a, const void *b)
+{
+    const struct kernel_export *e1 = a, *e2 = b;
+    int rc;
+
+    rc = prefix_order(e1->route.prefix, e1->route.plen,
+                      e2->route.prefix, e2->route.plen);
+    if(rc != 0)
+        return rc;
+    rc = prefix_order(e1->route.src_prefix, e1->route.src_plen,
+                      e2->route.src_prefix, e2->route.src_plen);
+    if(rc != 0)
+        return rc;
+    return e1->metric - e2->metric;
+}
+
+/* Applies the redistribution filters to a kernel route, which may change
+   its source prefix.  Returns the metric with which it is exported. */
+static int
+export_metric(struct kernel_route *route, int address)
 {
-    int i, j, metric, export, change = 0, rc;
-    struct kernel_route *routes;
     struct filter_result filter_result = {0};
-    int numroutes, numaddresses;
-    static int maxroutes = 8;
-    const int maxmaxroutes = 16 * 1024;
+    int metric;
+
+    if(martian_prefix(route->prefix, route->plen))
+        return INFINITY;
+
+    metric = redistribute_filter(route->prefix, route->plen,
+                                 route->src_prefix, route->src_plen,
+                                 route->ifindex, route->proto,
+                                 address ? NULL : &filter_result);
+    if(filter_result.src_prefix) {
+        memcpy(route->src_prefix, filter_result.src_prefix, 16);
+        route->src_plen = filter_result.src_plen;
+        metric = redistribute_filter(route->prefix, route->plen,
+                                     route->src_prefix, route->src_plen,
+                                     route->ifindex, route->proto,
+                                     NULL);
+    }
+    return metric;
+}
 
-    debugf("\nChecking kernel routes.\n");
+static void
+retract_xroute(struct xroute *xroute, int send_updates)
+{
+    unsigned char prefix[16], plen;
+    unsigned char src_prefix[16], src_plen;
+    struct babel_route *route;
+
+    memcpy(prefix, xroute->prefix, 16);
+    plen = xroute->plen;
+    memcpy(src_prefix, xroute->src_prefix, 16);
+    src_plen = xroute->src_plen;
+    flush_xroute(xroute);
+    route = find_best_route(prefix, plen, src_prefix, src_plen, 1, NULL);
+    if(route)
+        install_route(route);
+    /* send_update_resend only records the prefix, so the update
+       will only be sent after we perform all of the changes. */
+    if(send_updates)
+        send_update_resend(NULL, prefix, plen, src_prefix, src_plen);
+}
 
- again:
-    routes = calloc(maxroutes, sizeof(struct kernel_route));
-    if(routes == NULL)
-        return -1;
+/* Called when an xroute is created or its best origin changes. */
+static void
+announce_xroute(struct xroute *xroute, int send_updates)
+{
+    struct babel_route *route;
+
+    route = find_installed_route(xroute->prefix, xroute->plen,
+                                 xroute->src_prefix, xroute->src_plen);
+    if(route) {
+        if(allow_duplicates < 0 ||
+           xroute->origins->kernel_metric < allow_duplicates)
+            uninstall_route(route);
+    }
+    if(send_updates)
+        send_update(NULL, 0, xroute->prefix, xroute->plen,
+                    xroute->src_prefix, xroute->src_plen);
+}
 
-    rc = kernel_addresses(NULL, 0, 0, routes, maxroutes);
+static int
+export_route(struct kernel_route *kroute, int metric, int send_updates)
+{
+    struct xroute *xroute;
+    int rc;
+
+    xroute = find_xroute(kroute->prefix, kroute->plen,
+                         kroute->src_prefix, kroute->src_plen);
+    if(xroute == NULL) {
+        xroute = add_xroute(kroute->prefix, kroute->plen,
+                            kroute->src_prefix, kroute->src_plen);
+        if(xroute == NULL)
+            return -1;
+    }
+
+    rc = add_origin(xroute, kroute, metric);
     if(rc < 0) {
-        perror("kernel_addresses");
-        numroutes = 0;
-    } else {
-        numroutes = rc;
+        if(xroute->origins == NULL)
+            flush_xroute(xroute);
+        return -1;
     }
 
-    if(numroutes >= maxroutes)
-        goto resize;
+    if(!select_origin(xroute))
+        return 0;
+    announce_xroute(xroute, send_updates);
+    return 1;
+}
+
+/* Applies a single change to the kernel tables, as reported by
+   kernel_callback, without dumping them.  Removing one of the kernel
+   routes an xroute is exported from falls back to the next best one,
+   and only retracts the xroute when none remains. */
+int
+update_xroute(int add, struct kernel_route *kroute)
+{
+    struct xroute *xroute;
+    int metric;
 
-    numaddresses = numroutes;
+    metric = export_metric(kroute, kroute->proto == RTPROT_BABEL_LOCAL);
 
-    rc = kernel_routes(routes + numroutes, maxroutes - numroutes);
-    if(rc < 0)
-        fprintf(stderr, "Couldn't get kernel routes.\n");
-    else
-        numroutes += rc;
-
-    if(numroutes >= maxroutes)
-        goto resize;
-
-    /* Apply filter to kernel routes (e.g. change the source prefix). */
-
-    for(i = numaddresses; i < numroutes; i++) {
-        filter_result.src_prefix = NULL;
-        redistribute_filter(routes[i].prefix, routes[i].plen,
-                            routes[i].src_prefix, routes[i].src_plen,
-                            routes[i].ifindex, routes[i].proto,
-                            &filter_result);
-        if(filter_result.src_prefix) {
-            memcpy(routes[i].src_prefix, filter_result.src_prefix, 16);
-            routes[i].src_plen = filter_result.src_plen;
+    if(add) {
+        if(metric >= INFINITY)
+            return 0;
+        return export_route(kroute, metric, 1);
+    }
+
+    xroute = find_xroute(kroute->prefix, kroute->plen,
+                         kroute->src_prefix, kroute->src_plen);
+    if(xroute == NULL || !remove_origin(xroute, kroute))
+        return 0;
+
+    if(xroute->origins == NULL) {
+        retract_xroute(xroute, 1);
+        return 1;
+    }
+
+    if(select_origin(xroute))
+        announce_xroute(xroute, 1);
+    return 1;
+}
+
+/* Called by the kernel dumps for every kernel route: applies the filters
+   and records the route if it is to be exported. */
+static int
+collect_export(struct kernel_route *route, void *closure)
+{
+    struct kernel_exports *exports = closure;
+    int metric;
+
+    metric = export_metric(route, exports->addresses);
+    if(metric >= INFINITY)
+        return 0;
+
+    if(exports->numexports >= exports->maxexports) {
+        struct kernel_export *new;
+        int n = MAX(2 * exports->maxexports, 64);
+        new = realloc(exports->exports, n * sizeof(struct kernel_export));
+        if(new == NULL) {
+            perror("realloc(exports)");
+            exports->failed = 1;
+            return -1;
         }
+        exports->exports = new;
+        exports->maxexports = n;
+    }
+
+    exports->exports[exports->numexports].route = *route;
+    exports->exports[exports->numexports].metric = metric;
+    exports->numexports++;
+    return 1;
+}
 
+int
+check_xroutes(int send_updates)
+{
+    int i, j, k, change = 0, rc;
+    struct kernel_exports exports = {NULL, 0, 0, 0, 0};
+    struct kernel_export *e;
+    struct trie_node *dst = NULL, *slot, *next;
+    /* The number of routes exported last time, used to size the array. */
+    static int lastexports = 0;
+
+    debugf("\nChecking kernel routes.\n");
+
+    if(lastexports > 0) {
+        exports.exports = malloc(lastexports * sizeof(struct kernel_export));
+        if(exports.exports != NULL)
+            exports.maxexports = lastexports;
     }
 
-    /* Check for any routes that need to be flushed */
+    /* Apply filter to kernel routes (e.g. change the source prefix), and
+       compute the metric with which they would be exported, while they
+       are being dumped. */
 
-    i = 0;
-    while(i < numxroutes) {
-        export = 0;
-        metric = redistribute_filter(xroutes[i].prefix, xroutes[i].plen,
-                                     xroutes[i].src_prefix, xroutes[i].src_plen,
-                                     xroutes[i].ifindex, xroutes[i].proto,
-                                     NULL);
-        if(metric < INFINITY && metric == xroutes[i].metric) {
-            for(j = 0; j < numroutes; j++) {
-                if(xroutes[i].plen == routes[j].plen &&
-                   memcmp(xroutes[i].prefix, routes[j].prefix, 16) == 0 &&
-                   xroutes[i].ifindex == routes[j].ifindex &&
-                   xroutes[i].proto == routes[j].proto) {
-                    export = 1;
-                    break;
-                }
-            }
+    exports.addresses = 1;
+    rc = kernel_addresses(NULL, 0, 0, collect_export, &exports);
+    if(rc < 0)
+        perror("kernel_addresses");
+
+    exports.addresses = 0;
+    rc = kernel_routes(collect_export, &exports);
+    if(rc < 0)
+        fprintf(stderr, "Couldn't get kernel routes.\n");
+
+    if(exports.failed) {
+        /* Better not to export anything new than to retract everything. */
+        free(exports.exports);
+        return -1;
+    }
+
+    /* Sort in the order of the xroute table, so that we can walk both in
+       step.  Among routes to the same prefix, the best one comes first. */
+    e = exports.exports;
+    qsort(e, exports.numexports, sizeof(struct kernel_export), export_compare);
+
+    /* Check for any routes that need to be flushed or changed */
+
+    j = 0;
+    next = trie_next_sub(xroute_trie, &dst, NULL, 0);
+    while(next) {
+        struct xroute *xroute;
+        slot = next;
+        next = trie_next_sub(xroute_trie, &dst, slot, 0);
+        xroute = slot->data;
+
+        while(j < exports.numexports &&
+              xroute_compare(xroute, &e[j].route) > 0)
+            j++;
+
+        /* Replace the origins by the routes in this dump. */
+        flush_origins(xroute);
+        for(k = j; k < exports.numexports; k++) {
+            if(xroute_compare(xroute, &e[k].route) != 0)
+                break;
+            rc = add_origin(xroute, &e[k].route, e[k].metric);
+            if(rc < 0)
+                break;
         }
 
-        if(!export) {
-            unsigned char prefix[16], plen;
-            unsigned char src_prefix[16], src_plen;
-            struct babel_route *route;
-            memcpy(prefix, xroutes[i].prefix, 16);
-            plen = xroutes[i].plen;
-            memcpy(src_prefix, xroutes[i].src_prefix, 16);
-            src_plen = xroutes[i].src_plen;
-            flush_xroute(&xroutes[i]);
-            route = find_best_route(prefix, plen, src_prefix, src_plen, 1,NULL);
-            if(route)
-                install_route(route);
-            /* send_update_resend only records the prefix, so the update
-               will only be sent after we perform all of the changes. */
-            if(send_updates)
-                send_update_resend(NULL, prefix, plen, src_prefix, src_plen);
+        if(xroute->origins == NULL) {
+            retract_xroute(xroute, send_updates);
+            change = 1;
+        } else if(select_origin(xroute)) {
+            announce_xroute(xroute, send_updates);
             change = 1;
-        } else {
-            i++;
         }
     }
 
-    /* Add any new routes */
-
-    for(i = 0; i < numroutes; i++) {
-        if(martian_prefix(routes[i].prefix, routes[i].plen))
-            continue;
-        metric = redistribute_filter(routes[i].prefix, routes[i].plen,
-                                     routes[i].src_prefix, routes[i].src_plen,
-                                     routes[i].ifindex, routes[i].proto, NULL);
-        if(metric < INFINITY) {
-            rc = add_xroute(routes[i].prefix, routes[i].plen,
-                            routes[i].src_prefix, routes[i].src_plen,
-                            metric, routes[i].ifindex, routes[i].proto);
-            if(rc > 0) {
-                struct babel_route *route;
-                route = find_installed_route(routes[i].prefix, routes[i].plen,
-                                             routes[i].src_prefix,
-                                             routes[i].src_plen);
-                if(route) {
-                    if(allow_duplicates < 0 ||
-                       routes[i].metric < allow_duplicates)
-                        uninstall_route(route);
-                }
-                change = 1;
-                if(send_updates)
-                    send_update(NULL, 0, routes[i].prefix, routes[i].plen,
-                                routes[i].src_prefix, routes[i].src_plen);
-            }
-        }
+    /* Add any new routes; those already recorded above are left alone. */
+
+    for(i = 0; i < exports.numexports; i++) {
+        rc = export_route(&e[i].route, e[i].metric, send_updates);
+        if(rc > 0)
+            change = 1;
     }
 
-    free(routes);
-    /* Set up maxroutes for the next call. */
-    maxroutes = MIN(numroutes + 8, maxmaxroutes);
+    lastexports = exports.numexports;
+    free(exports.exports);
     return change;
-
- resize:
-    free(routes);
-    if(maxroutes >= maxmaxroutes)
-        return -1;
-    maxroutes = MIN(maxmaxroutes, 2 * maxroutes);
-    goto again;
 }
@@ -20,6 +20,9 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+struct xroute_origin;
+
+/* The metric, ifindex and proto are those of the best origin. */
 struct xroute {
     unsigned char prefix[16];
     unsigned char plen;
@@ -28,18 +31,18 @@ struct xroute {
     unsigned short metric;
     unsigned int ifindex;
     int proto;
+    struct xroute_origin *origins;
 };
 
 struct xroute_stream;
+struct kernel_route;
 
 struct xroute *find_xroute(const unsigned char *prefix, unsigned char plen,
                 const unsigned char *src_prefix, unsigned char src_plen);
 void flush_xroute(struct xroute *xroute);
-int add_xroute(unsigned char prefix[16], unsigned char plen,
-               unsigned char src_prefix[16], unsigned char src_plen,
-               unsigned short metric, unsigned int ifindex, int proto);
 int xroutes_estimate(void);
 struct xroute_stream *xroute_stream();
 struct xroute *xroute_stream_next(struct xroute_stream *stream);
 void xroute_stream_done(struct xroute_stream *stream);
+int update_xroute(int add, struct kernel_route *kroute);
 int check_xroutes(int send_updates);